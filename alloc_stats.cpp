@@ -0,0 +1,41 @@
+//Heap allocation counting
+#include "alloc_stats.h"
+#include <cstdlib>
+#include <new>
+//per thread, so counting doesn't make threads contend, and one thread's allocations can be told apart from the others'
+static thread_local AllocCounts threadAllocs;
+/**
+Returns the number of allocations and the bytes allocated so far by the calling thread
+*/
+AllocCounts getThreadAllocs()
+{
+    return threadAllocs;
+}
+#ifndef SDL_BASE_NO_ALLOC_HOOK
+//new[] and the nothrow versions call this one, and delete[] calls operator delete(void*)
+void *operator new(std::size_t n)
+{
+    threadAllocs.count++;
+    threadAllocs.bytes += n;
+    if(n == 0)
+        n = 1;
+    while(true)
+    {
+        void *p = std::malloc(n);
+        if(p != NULL)
+            return p;
+        std::new_handler h = std::get_new_handler();
+        if(h == NULL)
+            throw std::bad_alloc();
+        h();
+    }
+}
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+#endif
@@ -0,0 +1,12 @@
+/*Heap allocation counting, through a replacement of the global operator new. Compiled out if SDL_BASE_NO_ALLOC_HOOK is defined, in
+which case the counts stay at 0.
+*/
+#pragma once
+struct AllocCounts
+{
+    long long count = 0, bytes = 0;
+};
+/**
+Returns the number of allocations and the bytes allocated so far by the calling thread
+*/
+AllocCounts getThreadAllocs();
@@ -0,0 +1,79 @@
+//Assets embedded in the executable
+#include "assets.h"
+#include <fstream>
+#include <streambuf>
+#include <algorithm>
+#ifdef SDL_BASE_EMBED_ASSETS
+#include "embedded_assets.h"
+#else
+static const unsigned char embedded_asset_data[1] = {0};
+static constexpr EmbeddedAsset embedded_assets[1] = {{"", 0, 0}};
+static constexpr size_t num_embedded_assets = 0;
+#endif
+//reads a block of memory in place
+struct MemoryBuf: std::streambuf
+{
+    MemoryBuf(const char *data, size_t size)
+    {
+        char *p = const_cast<char*>(data); //only ever read, since there's no put area
+        setg(p, p, p + size);
+    }
+    pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode) override
+    {
+        char *p = (dir == std::ios::beg? eback() : dir == std::ios::cur? gptr() : egptr()) + off;
+        if(p < eback() || p > egptr())
+            return pos_type(off_type(-1));
+        setg(eback(), p, egptr());
+        return pos_type(p - eback());
+    }
+    pos_type seekpos(pos_type pos, std::ios::openmode which) override
+    {
+        return seekoff(off_type(pos), std::ios::beg, which);
+    }
+};
+struct MemoryStream: std::istream
+{
+    MemoryBuf buf;
+    MemoryStream(const char *data, size_t size): std::istream(NULL), buf(data, size)
+    {
+        rdbuf(&buf);
+    }
+};
+/**
+Finds an embedded file's contents. Returns false if it isn't embedded.
+*/
+bool findEmbeddedAsset(std::string_view name, const unsigned char *&data, size_t &size)
+{
+    if(name.substr(0, 2) == "./")
+        name.remove_prefix(2);
+    //the generator sorts the index by name
+    const EmbeddedAsset *end = embedded_assets + num_embedded_assets;
+    const EmbeddedAsset *a = std::lower_bound(embedded_assets, end, name, [](const EmbeddedAsset &a, std::string_view n){return a.name < n;});
+    if(a == end || a->name != name)
+        return false;
+    data = embedded_asset_data + a->offset;
+    size = a->size;
+    return true;
+}
+/**
+Returns a read only SDL_RWops over an embedded file, or NULL if it isn't embedded
+*/
+SDL_RWops *openEmbeddedRW(std::string_view name)
+{
+    const unsigned char *data;
+    size_t size;
+    if(!findEmbeddedAsset(name, data, size))
+        return NULL;
+    return SDL_RWFromConstMem(data, size);
+}
+/**
+Opens an embedded file as a stream, or the file itself if it isn't embedded. Check fail() on the result as on an ifstream.
+*/
+std::unique_ptr<std::istream> openAsset(const std::string &name, std::ios::openmode mode)
+{
+    const unsigned char *data;
+    size_t size;
+    if(findEmbeddedAsset(name, data, size))
+        return std::make_unique<MemoryStream>((const char*)data, size);
+    return std::make_unique<std::ifstream>(name, mode | std::ios::in);
+}
@@ -0,0 +1,29 @@
+/*Assets embedded in the executable. Building with SDL_BASE_EMBED_ASSETS includes embedded_assets.h, generated by embed_assets from
+the files a deployment needs, and the loaders look there before the file system (except for the config file, whose embedded copy
+only supplies defaults when there's none on disk). Embedded files are read in place from the executable's read-only data, without
+being copied.
+*/
+#pragma once
+#include <string>
+#include <string_view>
+#include <istream>
+#include <memory>
+#include <cstddef>
+#include <SDL2/SDL.h>
+struct EmbeddedAsset
+{
+    const char *name; //path as the program opens it, with / separators
+    size_t offset, size; //in embedded_asset_data
+};
+/**
+Finds an embedded file's contents. Returns false if it isn't embedded.
+*/
+bool findEmbeddedAsset(std::string_view name, const unsigned char *&data, size_t &size);
+/**
+Returns a read only SDL_RWops over an embedded file, or NULL if it isn't embedded
+*/
+SDL_RWops *openEmbeddedRW(std::string_view name);
+/**
+Opens an embedded file as a stream, or the file itself if it isn't embedded. Check fail() on the result as on an ifstream.
+*/
+std::unique_ptr<std::istream> openAsset(const std::string &name, std::ios::openmode mode = std::ios::in);
@@ -0,0 +1,109 @@
+//Generates embedded_assets.h, which builds with SDL_BASE_EMBED_ASSETS compile into the executable (see assets.h)
+//Build with g++ -std=c++17 embed_assets.cpp -o embed_assets
+//Usage: embed_assets <output header> <file or directory>...
+//e.g. embed_assets embedded_assets.h font.ttf sdl_base_config.txt seq1.txt seq1data
+//Files are stored as they are; PNG and JPEG images are already compressed, and are decoded on the decoder threads as usual.
+//The header pulls the files in with the assembler's .incbin (so it needs GCC or Clang) by absolute path instead of spelling out
+//their bytes, so it stays small and compiles quickly, but the files have to be there when it's compiled, and anything that
+//includes it has to be rebuilt when they change.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+namespace fs = std::filesystem;
+//names are paths as the program opens them, relative to its working directory and with / separators
+static std::string assetName(const fs::path &p)
+{
+    std::string s = p.lexically_normal().generic_string();
+    if(s.compare(0, 2, "./") == 0)
+        s.erase(0, 2);
+    return s;
+}
+//escapes a string for a C++ string literal (or an assembler one)
+static std::string quote(const std::string &s)
+{
+    std::string res = "\"";
+    for(char c: s)
+    {
+        if(c == '\n')
+        {
+            res += "\\n";
+            continue;
+        }
+        if(c == '"' || c == '\\')
+            res += '\\';
+        res += c;
+    }
+    return res + "\"";
+}
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        std::cerr << "Usage: embed_assets <output header> <file or directory>...\n";
+        return 1;
+    }
+    std::vector<std::string> files;
+    for(int i=2; i<argc; i++)
+    {
+        fs::path p = argv[i];
+        if(fs::is_directory(p))
+        {
+            for(auto &e: fs::recursive_directory_iterator(p))
+                if(e.is_regular_file())
+                    files.push_back(assetName(e.path()));
+        }
+        else if(fs::is_regular_file(p))
+            files.push_back(assetName(p));
+        else
+        {
+            std::cerr << "Can't find " << argv[i] << "\n";
+            return 1;
+        }
+    }
+    //the loader binary searches the index
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    std::ofstream fout(argv[1]);
+    fout << "//Generated by embed_assets, don't edit\n#pragma once\n#include \"assets.h\"\n";
+    //read only data sections differ between object file formats
+    fout << "#if defined(__APPLE__)\n#define EMBEDDED_ASSETS_BEGIN \".const\\n\"\n#define EMBEDDED_ASSETS_END \".text\\n\"\n";
+    fout << "#elif defined(_WIN32)\n#define EMBEDDED_ASSETS_BEGIN \".section .rdata,\\\"dr\\\"\\n\"\n#define EMBEDDED_ASSETS_END \".text\\n\"\n";
+    fout << "#else\n#define EMBEDDED_ASSETS_BEGIN \".pushsection .rodata\\n\"\n#define EMBEDDED_ASSETS_END \".popsection\\n\"\n#endif\n";
+    fout << "__asm__(\n    EMBEDDED_ASSETS_BEGIN\n    \".p2align 4\\n\"\n    \"embedded_asset_data:\\n\"\n";
+    std::vector<size_t> offsets, sizes;
+    size_t offset = 0;
+    for(auto &f: files)
+    {
+        std::error_code ec;
+        size_t size = fs::file_size(f, ec);
+        if(ec)
+        {
+            std::cerr << "Can't read " << f << "\n";
+            return 1;
+        }
+        offsets.push_back(offset);
+        sizes.push_back(size);
+        if(size > 0)
+            fout << "    " << quote(".incbin " + quote(fs::absolute(f).generic_string()) + "\n") << "\n";
+        offset += size;
+    }
+    //so the data is never empty
+    fout << "    \".byte 0\\n\"\n    EMBEDDED_ASSETS_END);\n";
+    fout << "extern \"C\" const unsigned char embedded_asset_data[] __asm__(\"embedded_asset_data\");\n";
+    fout << "static constexpr EmbeddedAsset embedded_assets[] = {\n";
+    for(size_t i=0; i<files.size(); i++)
+        fout << "    {" << quote(files[i]) << ", " << offsets[i] << ", " << sizes[i] << "},\n";
+    if(files.empty())
+        fout << "    {\"\", 0, 0},\n";
+    fout << "};\nstatic constexpr size_t num_embedded_assets = " << files.size() << ";\n";
+    if(!fout)
+    {
+        std::cerr << "Failed to write " << argv[1] << "\n";
+        return 1;
+    }
+    std::cout << "Embedded " << files.size() << " files, " << offset << " bytes\n";
+    return 0;
+}
@@ -0,0 +1,96 @@
+//Binary input logs
+#include "input_log.h"
+#include "logger.h"
+static const char INPUT_LOG_MAGIC[8] = {'S', 'C', 'A', 'L', 'E', 'I', 'N', '1'};
+static const uint8_t ENTRY_EVENT = 0, ENTRY_STEP = 1;
+//values are written in the machine's own layout, since logs are replayed where they're recorded
+template<class T> static void put(std::ofstream &fout, const T &x)
+{
+    fout.write((const char*)&x, sizeof(T));
+}
+template<class T> static bool get(std::ifstream &fin, T &x)
+{
+    return (bool)fin.read((char*)&x, sizeof(T));
+}
+/**
+Starts a log. Returns false on failure.
+*/
+bool InputRecorder::open(const std::string &file_name, const InputLogHeader &h)
+{
+    fout.open(file_name, std::ios::binary);
+    if(!fout)
+    {
+        logError("Failed to open input log %s", file_name);
+        return false;
+    }
+    fout.write(INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC));
+    put(fout, (uint32_t)h.scene.size());
+    fout.write(h.scene.data(), h.scene.size());
+    put(fout, (int32_t)h.window_w);
+    put(fout, (int32_t)h.window_h);
+    put(fout, h.scale);
+    put(fout, h.target_scale);
+    put(fout, (uint8_t)h.paused);
+    start = getTicksNs();
+    return true;
+}
+/**
+Records an event handled before step step. Only the kinds of events that change what's shown are kept.
+*/
+void InputRecorder::event(uint32_t step, const SDL_Event &e)
+{
+    if(e.type != SDL_QUIT && e.type != SDL_KEYDOWN && e.type != SDL_KEYUP && e.type != SDL_MOUSEWHEEL && e.type != SDL_WINDOWEVENT)
+        return;
+    put(fout, ENTRY_EVENT);
+    put(fout, step);
+    put(fout, getTicksNs() - start);
+    put(fout, e);
+}
+/**
+Records a step and the scale it reached
+*/
+void InputRecorder::stepped(uint32_t step, double scale)
+{
+    put(fout, ENTRY_STEP);
+    put(fout, step);
+    put(fout, getTicksNs() - start);
+    put(fout, scale);
+}
+/**
+Reads a whole log. Returns false on failure.
+*/
+bool loadInputLog(const std::string &file_name, InputLogHeader &h, std::vector<InputLogEntry> &entries)
+{
+    std::ifstream fin(file_name, std::ios::binary);
+    char magic[sizeof(INPUT_LOG_MAGIC)];
+    uint32_t scene_size;
+    int32_t w, ht;
+    uint8_t paused;
+    if(!fin.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != std::string(INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC)) ||
+       !get(fin, scene_size))
+    {
+        logError("%s isn't an input log", file_name);
+        return false;
+    }
+    h.scene.resize(scene_size);
+    fin.read(&h.scene[0], scene_size);
+    if(!get(fin, w) || !get(fin, ht) || !get(fin, h.scale) || !get(fin, h.target_scale) || !get(fin, paused))
+    {
+        logError("Truncated input log %s", file_name);
+        return false;
+    }
+    h.window_w = w;
+    h.window_h = ht;
+    h.paused = paused;
+    entries.clear();
+    uint8_t type;
+    while(get(fin, type))
+    {
+        InputLogEntry e{};
+        e.is_step = type == ENTRY_STEP;
+        if(!get(fin, e.step) || !get(fin, e.ns) || !(e.is_step? get(fin, e.scale) : get(fin, e.event)))
+            break; //the last entry may be cut short if the program didn't exit cleanly
+        entries.push_back(e);
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+/*Binary logs of the input events main() handles and the scale after each step, so a session can be replayed as a benchmark.
+Events are tagged with the number of steps taken before them, so replaying them at the same steps reproduces the same zoom.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include "sdl_base.h"
+struct InputLogHeader
+{
+    std::string scene;
+    int window_w, window_h;
+    double scale, target_scale;
+    bool paused;
+};
+struct InputLogEntry
+{
+    bool is_step;
+    uint32_t step; //steps taken before it
+    long long ns; //since the log was started
+    SDL_Event event; //if it's not a step
+    double scale; //after the step, if it is one
+};
+struct InputRecorder
+{
+    std::ofstream fout;
+    long long start = 0;
+    /**
+    Starts a log. Returns false on failure.
+    */
+    bool open(const std::string &file_name, const InputLogHeader &h);
+    /**
+    Records an event handled before step step. Only the kinds of events that change what's shown are kept.
+    */
+    void event(uint32_t step, const SDL_Event &e);
+    /**
+    Records a step and the scale it reached
+    */
+    void stepped(uint32_t step, double scale);
+    bool isOpen() const
+    {
+        return fout.is_open();
+    }
+};
+/**
+Reads a whole log. Returns false on failure.
+*/
+bool loadInputLog(const std::string &file_name, InputLogHeader &h, std::vector<InputLogEntry> &entries);
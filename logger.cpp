@@ -0,0 +1,224 @@
+//Asynchronous logging
+#include "logger.h"
+#include "trace.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+static const size_t LOG_QUEUE_SIZE = 1024; //must be a power of 2
+static const int LOG_WRITER_WAIT = 20; //ms the writer sleeps for at most when the queue is empty, in case a wakeup was missed
+//bounded multi-producer queue: each slot's sequence number says whether it's free for the producer that claimed position pos
+//(sequence == pos) or holds a record for the writer (sequence == pos + 1)
+struct LogSlot
+{
+    std::atomic<size_t> sequence;
+    LogRecord r;
+};
+static LogSlot logQueue[LOG_QUEUE_SIZE];
+static std::atomic<size_t> enqueuePos(0);
+static size_t dequeuePos = 0; //only the writer reads records
+static std::atomic<long long> droppedLogs(0);
+static std::once_flag logInitFlag;
+static std::thread logWriter;
+static std::atomic<bool> logRunning(false), writerWaiting(false);
+static std::atomic<size_t> written(0); //records taken off the queue so far
+static std::mutex logMutex; //only for sleeping and waking, and for writing directly once the writer has stopped
+static std::condition_variable logWake, logDrained;
+void LogRecord::add(std::string_view x)
+{
+    LogArg &a = add('s');
+    if(text_used + x.size() + 1 <= (size_t)LOG_TEXT_SIZE)
+    {
+        a.s = text_used;
+        memcpy(text + text_used, x.data(), x.size());
+        text_used += x.size();
+        text[text_used++] = 0;
+    }
+    else
+    {
+        a.type = 'S';
+        a.heap = (char*)malloc(x.size() + 1);
+        memcpy(a.heap, x.data(), x.size());
+        a.heap[x.size()] = 0;
+    }
+}
+LogArg &LogRecord::add(char type)
+{
+    LogArg &a = args[num_args++];
+    a.type = type;
+    return a;
+}
+static const char *logString(const LogRecord &r, const LogArg &a)
+{
+    return a.type == 'S'? a.heap : r.text + a.s;
+}
+/**
+Formats a record's message printf style. Only the d, i, u, x, X, o, c, f, F, e, E, g, G, a, A and s conversions are supported,
+and length modifiers are ignored, since integers are always stored as long long.
+*/
+std::string formatLogRecord(const LogRecord &r)
+{
+    std::string res;
+    int arg = 0;
+    char buf[512];
+    for(const char *p = r.format; *p; p++)
+    {
+        if(*p != '%')
+        {
+            res += *p;
+            continue;
+        }
+        if(p[1] == '%')
+        {
+            res += '%';
+            p++;
+            continue;
+        }
+        //copy the flags, width and precision, and skip the length modifiers
+        std::string spec = "%";
+        for(p++; *p && strchr("-+ #0123456789.", *p); p++)
+            spec += *p;
+        while(*p && strchr("hlLqjzt", *p))
+            p++;
+        if(*p == 0)
+            break;
+        char conv = *p;
+        if(arg >= r.num_args)
+        {
+            res += "(missing)";
+            continue;
+        }
+        const LogArg &a = r.args[arg++];
+        double d = a.type == 'd'? a.d : a.type == 'u'? (double)a.u : (double)a.i;
+        long long i = a.type == 'd'? (long long)a.d : a.i;
+        if(a.type == 's' || a.type == 'S')
+            snprintf(buf, sizeof(buf), (spec + 's').c_str(), logString(r, a));
+        else if(strchr("di", conv))
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), i);
+        else if(strchr("uxXo", conv))
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), a.type == 'u'? a.u : (unsigned long long)i);
+        else if(conv == 'c')
+            snprintf(buf, sizeof(buf), (spec + 'c').c_str(), (int)i);
+        else if(strchr("fFeEgGaA", conv))
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), d);
+        else if(a.type == 'd')
+            snprintf(buf, sizeof(buf), "%g", d);
+        else snprintf(buf, sizeof(buf), "%lld", i);
+        res += buf;
+    }
+    return res;
+}
+static void writeRecord(LogRecord &r)
+{
+    static const char *const LEVEL_NAMES[] = {"debug: ", "", "warning: ", "error: "};
+    std::string s = "[" + seconds_to_str(r.ns / 1000000000) + "]" + LEVEL_NAMES[r.level] + formatLogRecord(r);
+    for(int i=0; i<r.num_args; i++)
+    {
+        if(r.args[i].type == 'S')
+            free(r.args[i].heap);
+    }
+    std::puts(s.c_str());
+}
+static void writeLogs()
+{
+    traceThreadName("logger");
+    while(true)
+    {
+        LogSlot &slot = logQueue[dequeuePos & (LOG_QUEUE_SIZE - 1)];
+        if(slot.sequence.load(std::memory_order_acquire) == dequeuePos + 1)
+        {
+            writeRecord(slot.r);
+            slot.sequence.store(dequeuePos + LOG_QUEUE_SIZE, std::memory_order_release);
+            dequeuePos++;
+            written.store(dequeuePos, std::memory_order_release);
+            continue;
+        }
+        std::fflush(stdout);
+        long long dropped = droppedLogs.exchange(0);
+        if(dropped > 0)
+            std::printf("[%s]warning: %lld log messages were dropped because the queue was full\n", seconds_to_str(getTicksS()).c_str(), dropped);
+        std::unique_lock<std::mutex> lock(logMutex);
+        logDrained.notify_all();
+        if(!logRunning && enqueuePos.load() == dequeuePos)
+            break;
+        //producers only wake the writer if they see it waiting, so check again after saying so
+        writerWaiting = true;
+        if(slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+            logWake.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_WAIT));
+        writerWaiting = false;
+    }
+    std::fflush(stdout);
+}
+static void stopLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        logRunning = false;
+        logWake.notify_one();
+    }
+    logWriter.join();
+}
+static void startLog()
+{
+    for(size_t i=0; i<LOG_QUEUE_SIZE; i++)
+        logQueue[i].sequence.store(i, std::memory_order_relaxed);
+    logRunning = true;
+    logWriter = std::thread(writeLogs);
+    atexit(stopLog);
+}
+/**
+Queues a record for the writer thread
+*/
+void submitLog(LogRecord &r)
+{
+    std::call_once(logInitFlag, startLog);
+    if(!logRunning) //exiting, so there's no writer anymore
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        writeRecord(r);
+        std::fflush(stdout);
+        return;
+    }
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    while(true)
+    {
+        slot = &logQueue[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if(sequence == pos)
+        {
+            if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(sequence < pos) //full, and logging must never block
+        {
+            droppedLogs++;
+            for(int i=0; i<r.num_args; i++)
+            {
+                if(r.args[i].type == 'S')
+                    free(r.args[i].heap);
+            }
+            return;
+        }
+        else pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+    slot->r = r;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    if(writerWaiting)
+        logWake.notify_one();
+}
+/**
+Blocks until everything logged so far has been written
+*/
+void flushLog()
+{
+    if(!logRunning)
+        return;
+    size_t target = enqueuePos.load();
+    std::unique_lock<std::mutex> lock(logMutex);
+    logWake.notify_one();
+    logDrained.wait(lock, [target]{return written.load() >= target || !logRunning;});
+}
@@ -0,0 +1,91 @@
+/*Asynchronous logging. Messages are put in a lock-free queue with their arguments and formatted and written to stdout by a
+background thread, so logging never waits on stdout and can be done from any thread. Messages below LOG_LEVEL in
+sdl_base_config.txt are dropped before anything is copied.
+*/
+#pragma once
+#include <string>
+#include <string_view>
+#include "sdl_base.h"
+enum LogLevel {LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR};
+static const int LOG_MAX_ARGS = 8;
+static const int LOG_TEXT_SIZE = 256; //room for copies of the string arguments of one message
+struct LogArg
+{
+    char type; //'i', 'u', 'd', 's' or 'S'
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        int s; //offset of the string in LogRecord::text
+        char *heap; //strings that don't fit in LogRecord::text are malloc'ed, and freed once written
+    };
+};
+/**
+A message waiting to be formatted. format must be a string literal, since only the pointer is kept; string arguments are copied.
+*/
+struct LogRecord
+{
+    LogLevel level;
+    long long ns; //getTicksNs() when it was logged
+    const char *format;
+    int num_args = 0, text_used = 0;
+    LogArg args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+    void add(long long x){add('i').i = x;}
+    void add(unsigned long long x){add('u').u = x;}
+    void add(int x){add((long long)x);}
+    void add(long x){add((long long)x);}
+    void add(unsigned x){add((unsigned long long)x);}
+    void add(unsigned long x){add((unsigned long long)x);}
+    void add(double x){add('d').d = x;}
+    void add(std::string_view x);
+    void add(const char *x){add(std::string_view(x == NULL? "(null)" : x));}
+    void add(const std::string &x){add(std::string_view(x));}
+private:
+    LogArg &add(char type);
+};
+/**
+Formats a record's message printf style. Only the d, i, u, x, X, o, c, f, F, e, E, g, G, a, A and s conversions are supported,
+and length modifiers are ignored, since integers are always stored as long long.
+*/
+std::string formatLogRecord(const LogRecord &r);
+/**
+Queues a record for the writer thread
+*/
+void submitLog(LogRecord &r);
+/**
+Blocks until everything logged so far has been written
+*/
+void flushLog();
+/**
+Logs a message printf style, e.g. logMessage(LOG_ERROR, "Failed to load %s: %s", name, SDL_GetError())
+*/
+template<class... Args> void logMessage(LogLevel level, const char *format, const Args&... args)
+{
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    if(level < sdl_settings::logLevel)
+        return;
+    LogRecord r;
+    r.level = level;
+    r.ns = getTicksNs();
+    r.format = format;
+    (r.add(args), ...);
+    submitLog(r);
+}
+template<class... Args> void logDebug(const char *format, const Args&... args)
+{
+    logMessage(LOG_DEBUG, format, args...);
+}
+template<class... Args> void logInfo(const char *format, const Args&... args)
+{
+    logMessage(LOG_INFO, format, args...);
+}
+template<class... Args> void logWarning(const char *format, const Args&... args)
+{
+    logMessage(LOG_WARNING, format, args...);
+}
+template<class... Args> void logError(const char *format, const Args&... args)
+{
+    logMessage(LOG_ERROR, format, args...);
+}
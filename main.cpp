@@ -3,18 +3,53 @@
 #include <vector>
 #include <fstream>
 #include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <iterator>
+#include <ctime>
 #include "sdl_base.h"
+#include "tiled_image.h"
+#include "point_cloud.h"
+#include "trace.h"
+#include "logger.h"
+#include "input_log.h"
+#include "assets.h"
 using namespace std;
+static bool isDeepZoom(const string &file_name)
+{
+    return file_name.size() > 4 && file_name.compare(file_name.size() - 4, 4, ".dzi") == 0;
+}
+struct Placement
+{
+    double x, y, w, h;
+    uint8_t alpha;
+    bool visible;
+};
 struct Image
 {
     SDL_Texture *t;
+    shared_ptr<TiledImage> tiles; //used instead of t for Deep Zoom (.dzi) images
+    int tw, th; //texture size
+    SDL_Rect opaque; //part of the texture that hides whatever is behind it
     string name;
     double x, y;
     double w;
-    Image(const char *file_name, string name, double x, double y, double w)
+    int shard; //index of the sub-scene it was loaded from, or -1
+    string description; //shown in the info panel while the image is centred
+    string description_file; //read into description (if it exists) the first time the image is centred, then cleared
+    //while a timeline plays, images loaded with the scene are only decoded for the timeline times in resident
+    string file_name;
+    vector<pair<double, double> > resident;
+    shared_ptr<AsyncSurface> pending;
+    bool broken = false; //file_name couldn't be decoded, so it isn't tried again
+    Image(string name, double x, double y, double w, int shard)
     {
-        t = loadTexture(file_name, 0, 0, 0);
-        SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
+        t = NULL;
+        tw = th = 1;
+        opaque = SDL_Rect{0, 0, 0, 0};
         this->name = name;
         for(auto &i: this->name)
             if(i == '_')
@@ -22,109 +57,1149 @@ struct Image
         this->x = x;
         this->y = y;
         this->w = w;
+        this->shard = shard;
+    }
+    //a Deep Zoom image, other images are created empty and then uploaded once loadSurfaceAsync has decoded them
+    static Image fromDeepZoom(const string &file_name, string name, double x, double y, double w, int shard)
+    {
+        Image img(name, x, y, w, shard);
+        img.tiles = make_shared<TiledImage>();
+        if(img.tiles->load(file_name))
+        {
+            img.tw = img.tiles->width;
+            img.th = img.tiles->height;
+        }
+        return img;
+    }
+    //takes a surface decoded by the color keyed loadSurfaceAsync, whose opaque part was already found on the decoder thread
+    void upload(const AsyncSurface &s)
+    {
+        if(s.surface == NULL)
+            return;
+        t = createTexture(s.surface);
+        opaque = s.opaque;
+        tw = s.surface->w;
+        th = s.surface->h;
+    }
+    //draws the image into a view_w by view_h target, returns true if part of it is still loading
+    bool draw(const Placement &p, int view_w, int view_h)
+    {
+        if(tiles)
+            return tiles->render(p.x, p.y, p.w, p.h, p.alpha, view_w, view_h);
+        if(t != NULL)
+        {
+            SDL_SetTextureAlphaMod(t, p.alpha);
+            renderCopyF(t, NULL, p.x, p.y, p.w, p.h, view_w, view_h);
+        }
+        return false;
+    }
+};
+static const int MAX_STAMPED_INPUTS = 16;
+static const int MAX_LATENCY_SAMPLES = 4096; //latency is reported over the most recent inputs, so measuring never allocates
+//timeline time advances by 1/TIMELINE_FPS seconds per frame, like scale_per_frame, so a show takes the same path on any machine
+static const double TIMELINE_FPS = 60;
+static const double RESIDENCY_LEAD = 2; //seconds before a timeline brings an image into view that it starts decoding
+static const double RESIDENCY_LINGER = 0.5; //seconds its texture is kept after it leaves the view
+static const double RESIDENCY_VIEW_MARGIN = 1.25; //images this close to the view count as in it, in case the window is resized
+static const int MAX_SCHEDULED_UPLOADS_PER_FRAME = 4;
+static const double MIN_IMAGE_SIZE = 1; //images less than this many pixels across aren't drawn, so they aren't decoded for a timeline
+static const int EASE_LINEAR = 0, EASE_SMOOTH = 1;
+static const double ZOOM_EASING = 0.35; //fraction of the remaining (log) distance to the zoom target covered per frame
+static const double ZOOM_SNAP = 1e-4;
+//images at least this many window widths across change slowly on screen, so they are drawn into a cached background layer
+static const double IMPOSTOR_MIN_SIZE = 2;
+static const double IMPOSTOR_MARGIN = 1.25; //the background layer covers this much more than the window in each direction
+static const int IMPOSTOR_MAX_AGE = 30; //frames before the background layer is redrawn even if it's still usable
+static const double LABEL_BANDS_PER_DECADE = 20; //which labels are shown is only worked out again when the scale leaves its band
+static const double LABEL_PAN_STEP = 0.25; //or when the camera pans this fraction of the window width
+static const int LABEL_BOTTOM = 0, LABEL_TOP = 1; //label inside the bottom or top left corner of its image
+static const double SHARD_UNLOAD_MARGIN = 1.25; //how far past its scale range and region the camera goes before a sub-scene is unloaded
+static const int MAX_SHARD_UPLOADS_PER_FRAME = 4;
+static const uint8_t ORBIT_R = 110, ORBIT_G = 150, ORBIT_B = 255, ORBIT_A = 110;
+//the info panel is shown for the image at the centre of the window, if it's between these fractions of the window width
+static const double PANEL_MIN_SIZE = 0.2, PANEL_MAX_SIZE = 2;
+static const double PANEL_WIDTH = 0.25; //fraction of the window width
+//performance overlay, toggled with F3; the frame time graph's full height is twice FRAME_TIME_BUDGET
+static const int HUD_BAR_WIDTH = 1, HUD_GRAPH_HEIGHT = 60, HUD_LINES = 7;
+static atomic<bool> show_hud(false);
+//text for the info panel comes from <prefix>/<name>.txt if it exists. Most images don't have one, so it's only looked for once the
+//panel needs it instead of for every image at startup.
+static string descriptionFile(const string &prefix, const string &name)
+{
+    return prefix + "/" + name + ".txt";
+}
+static string loadDescription(const string &file_name)
+{
+    auto in = openAsset(file_name);
+    return string(istreambuf_iterator<char>(*in), istreambuf_iterator<char>());
+}
+//everything the render thread needs to know to draw a frame
+struct Camera
+{
+    double scale;
+    double x, y; //world position at the centre of the window
+    double time; //timeline time
+    bool paused; //the camera may have been moved by hand, off the timeline's path
+    //getTicksNs() of the input events this frame is the first to reflect
+    int num_inputs;
+    long long input_ns[MAX_STAMPED_INPUTS];
+};
+//input-to-photon latency: inputs are stamped on the main thread and measured on the render thread once presented
+struct LatencyStats
+{
+    int num_pending = 0;
+    long long pending[MAX_STAMPED_INPUTS];
+    vector<long long> samples = vector<long long>(MAX_LATENCY_SAMPLES); //ring of the latest samples
+    long long num_samples = 0;
+    void stamp()
+    {
+        if(num_pending < MAX_STAMPED_INPUTS)
+            pending[num_pending++] = getTicksNs();
+    }
+    void attach(Camera &c)
+    {
+        c.num_inputs = num_pending;
+        copy(pending, pending + num_pending, c.input_ns);
+        num_pending = 0;
+    }
+    void presented(const Camera &c)
+    {
+        long long now = getTicksNs();
+        for(int i=0; i<c.num_inputs; i++)
+            samples[num_samples++ % MAX_LATENCY_SAMPLES] = now - c.input_ns[i];
+    }
+    void report()
+    {
+        size_t n = min(num_samples, (long long)MAX_LATENCY_SAMPLES);
+        if(n == 0)
+            return;
+        sort(samples.begin(), samples.begin() + n);
+        auto ms = [&](double p)
+        {
+            return samples[min(n - 1, (size_t)(p * n))] / 1e6;
+        };
+        logInfo("Input-to-photon latency over the last %d inputs: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms", (int)n,
+                ms(0.5), ms(0.9), ms(0.99), ms(1));
+    }
+};
+struct Label
+{
+    int image;
+    int anchor;
+};
+//screen space rectangle from (x1, y1) to (x2, y2)
+struct ScreenRect
+{
+    double x1, y1, x2, y2;
+    ScreenRect clip(double w, double h) const
+    {
+        return ScreenRect{max(x1, 0.0), max(y1, 0.0), min(x2, w), min(y2, h)};
+    }
+    bool empty() const
+    {
+        return x1 >= x2 || y1 >= y2;
+    }
+    bool contains(const ScreenRect &r) const
+    {
+        return x1<=r.x1 && y1<=r.y1 && x2>=r.x2 && y2>=r.y2;
+    }
+    bool intersects(const ScreenRect &r) const
+    {
+        return x1<r.x2 && r.x1<x2 && y1<r.y2 && r.y1<y2;
+    }
+};
+struct PendingImage
+{
+    string file_name, name;
+    double x, y, w;
+    shared_ptr<AsyncSurface> surface;
+    string description_file;
+};
+//reads a sub-scene file on a decoder thread, sets up its Deep Zoom images and queues its other images for decoding there, so the
+//render thread only has to upload them
+struct ShardLoad: AsyncJob
+{
+    string file_name;
+    int shard;
+    vector<Image> images; //Deep Zoom images, ready to be inserted
+    vector<PendingImage> pending;
+    ShardLoad(const string &file_name, int shard): file_name(file_name), shard(shard){}
+    void run() override
+    {
+        TRACE_SCOPE("loadShard");
+        auto in = openAsset(file_name);
+        istream &fin = *in;
+        if(fin.fail())
+        {
+            logError("Failed to open sub-scene %s", file_name);
+            return;
+        }
+        string prefix, fname, name;
+        double x, y, w;
+        fin >> prefix;
+        while(fin >> fname)
+        {
+            if(fname == "include")
+            {
+                logWarning("Nested includes aren't supported in sub-scene %s", file_name);
+                getline(fin, fname);
+                continue;
+            }
+            fin >> name >> x >> y >> w;
+            string image_file = prefix + "/" + fname;
+            if(isDeepZoom(image_file)) //already loads lazily
+            {
+                images.push_back(Image::fromDeepZoom(image_file, name, x, y, w, shard));
+                images.back().description_file = descriptionFile(prefix, name);
+            }
+            else pending.push_back(PendingImage{image_file, name, x, y, w, loadSurfaceAsync(image_file, 0, 0, 0), descriptionFile(prefix, name)});
+        }
+    }
+};
+//a sub-scene file that's only loaded while the scale is within [min_scale, max_scale] and its region (like an image's) is in view
+struct Shard
+{
+    string file_name;
+    double min_scale, max_scale;
+    double x, y, w, h;
+    bool loaded = false;
+    shared_ptr<ShardLoad> load; //reading the file in the background
+    vector<PendingImage> pending; //being decoded in the background
+};
+//a point cloud covering the square from (x, y) to (x + w, y + w)
+struct StarField
+{
+    double x, y, w;
+    PointCloud cloud;
+};
+//a circle of radius r around (x, y)
+struct Orbit
+{
+    double x, y, r;
+};
+//the camera reaches scale and (x, y) at time, stays there for dwell seconds, then moves on to the next keyframe
+struct Keyframe
+{
+    double time, scale, x, y, dwell;
+    int easing; //of the move into this keyframe
+};
+struct Timeline
+{
+    vector<Keyframe> keys; //sorted by time
+    double duration() const
+    {
+        return keys.empty()? 0 : keys.back().time + keys.back().dwell;
+    }
+    //camera at time t, zooming at a constant rate between keyframes unless eased
+    void sample(double t, double &scale, double &x, double &y) const
+    {
+        size_t i = 0;
+        while(i+1 < keys.size() && keys[i+1].time <= t)
+            i++;
+        const Keyframe &a = keys[i];
+        double start = a.time + a.dwell;
+        if(i+1 == keys.size() || t <= start || keys[i+1].time <= start)
+        {
+            scale = a.scale;
+            x = a.x;
+            y = a.y;
+            return;
+        }
+        const Keyframe &b = keys[i+1];
+        double u = (t - start) / (b.time - start);
+        if(b.easing == EASE_SMOOTH)
+            u = u * u * (3 - 2*u);
+        scale = a.scale * pow(b.scale / a.scale, u);
+        x = a.x + (b.x - a.x) * u;
+        y = a.y + (b.y - a.y) * u;
     }
 };
 struct Displayer
 {
-    vector<Image> images;
+    vector<Image> images; //in drawing order, last first
+    vector<Shard> shards;
+    vector<StarField> star_fields; //drawn behind all live images
+    vector<Orbit> orbits;
+    //scratch space for render(), kept to avoid reallocating every frame
+    vector<Placement> placements;
+    vector<ScreenRect> occluders;
+    //labels that don't overlap, worked out once per scale band; label_grid buckets label_rects by screen cell while laying them out
+    vector<Label> labels;
+    int label_band = INT_MIN, label_w = 0, label_h = 0;
+    double label_x = 0, label_y = 0; //camera position they were laid out at
+    vector<int> label_order;
+    vector<ScreenRect> label_rects;
+    vector<vector<int> > label_grid;
+    TextLayout panel; //info panel text, only laid out again when it changes
+    //background layer: images from impostor_first on, drawn at impostor_scale into a window sized texture enlarged by IMPOSTOR_MARGIN
+    SDL_Texture *impostor = NULL;
+    int impostor_w = 0, impostor_h = 0;
+    int impostor_first = -1, impostor_age = 0;
+    bool impostor_loading = false; //part of it was still loading when it was drawn, so it's drawn again next frame
+    double impostor_scale = 0, impostor_x = 0, impostor_y = 0;
     double scale, end_scale;
+    double target_scale; //wheel zooms only move the target, play() eases scale toward it once per frame
     double scale_per_frame;
+    double pan_x = 0, pan_y = 0;
+    //if the scene has keyframes, they replace the zoom from scale to end_scale
+    Timeline timeline;
+    double time = 0;
     bool is_paused;
+    //set by the render thread while anything in view is still being decoded or waiting to be uploaded, so the main thread keeps asking
+    //for frames until it's shown; frame_loading collects it while a frame is drawn
+    atomic<bool> loading{false};
+    bool frame_loading = false;
     bool play()
     {
-        if(is_paused)
+        TRACE_SCOPE("play");
+        if(!timeline.keys.empty())
         {
-            return scale < end_scale;
+            if(!is_paused)
+            {
+                time = std::min(time + 1 / TIMELINE_FPS, timeline.duration());
+                timeline.sample(time, target_scale, pan_x, pan_y);
+            }
         }
-        scale *= scale_per_frame;
-        if(scale > end_scale)
+        else if(!is_paused)
+            target_scale = std::min(target_scale * scale_per_frame, end_scale);
+        scale *= pow(target_scale / scale, ZOOM_EASING);
+        if(fabs(log(target_scale / scale)) < ZOOM_SNAP)
+            scale = target_scale;
+        return isFinished();
+    }
+    bool isFinished()
+    {
+        return timeline.keys.empty()? scale >= end_scale : time >= timeline.duration();
+    }
+    void zoom(double factor)
+    {
+        target_scale *= factor;
+        if(!timeline.keys.empty()) //zooming by hand pauses the timeline until space is pressed
+            is_paused = true;
+    }
+    bool isStatic()
+    {
+        return (is_paused || isFinished()) && scale == target_scale && !loading;
+    }
+    Camera getCamera()
+    {
+        Camera c{};
+        c.scale = scale;
+        c.x = pan_x;
+        c.y = pan_y;
+        c.time = time;
+        c.paused = is_paused;
+        return c;
+    }
+    //anything that depends on image indices has to be worked out again
+    void sceneChanged()
+    {
+        label_band = INT_MIN;
+        impostor_first = -1;
+    }
+    void insertImage(const Image &img)
+    {
+        images.insert(find_if(images.begin(), images.end(), [&](const Image &i){return i.w > img.w;}), img);
+        sceneChanged();
+    }
+    void loadShard(int k)
+    {
+        Shard &s = shards[k];
+        s.loaded = true;
+        s.load = make_shared<ShardLoad>(s.file_name, k);
+        runAsync(s.load);
+    }
+    void unloadShard(int k)
+    {
+        for(auto &i: images)
+            if(i.shard == k && i.t != NULL)
+                SDL_DestroyTexture(i.t);
+        images.erase(remove_if(images.begin(), images.end(), [&](const Image &i){return i.shard == k;}), images.end());
+        shards[k].load.reset();
+        shards[k].pending.clear();
+        shards[k].loaded = false;
+        sceneChanged();
+    }
+    //loads and unloads sub-scenes as the camera moves, and uploads their images once they're read and decoded in the background
+    void updateShards(double scale, double cx, double cy, double W, double H)
+    {
+        double vx = scale / 2, vy = scale * H / W / 2; //the world in view is [cx - vx, cx + vx] by [cy - vy, cy + vy]
+        int uploads = 0;
+        for(size_t k=0; k<shards.size(); k++)
         {
-            scale = end_scale;
-            return true;
+            Shard &s = shards[k];
+            double m = s.loaded? SHARD_UNLOAD_MARGIN : 1;
+            bool in_view = s.x < cx + vx*m && s.x + s.w > cx - vx*m && s.y < cy + vy*m && s.y + s.h > cy - vy*m;
+            bool in_range = scale >= s.min_scale / m && scale <= s.max_scale * m;
+            if(!s.loaded && in_view && in_range)
+                loadShard(k);
+            else if(s.loaded && !(in_view && in_range))
+                unloadShard(k);
+            if(s.load && s.load->done)
+            {
+                for(auto &img: s.load->images)
+                    insertImage(img);
+                s.pending = move(s.load->pending);
+                s.load.reset();
+            }
+            for(size_t i=0; i<s.pending.size() && uploads<MAX_SHARD_UPLOADS_PER_FRAME; i++)
+            {
+                PendingImage &p = s.pending[i];
+                if(!p.surface->done)
+                    continue;
+                if(p.surface->surface != NULL)
+                {
+                    Image img(p.name, p.x, p.y, p.w, k);
+                    img.upload(*p.surface);
+                    img.description_file = move(p.description_file);
+                    insertImage(img);
+                    uploads++;
+                }
+                s.pending.erase(s.pending.begin() + i);
+                i--;
+            }
+            if(s.load || !s.pending.empty())
+                frame_loading = true;
         }
-        return false;
     }
-    void render()
+    //works out from the timeline when each image loaded with the scene is in view, so it's only decoded around those times
+    void scheduleResidency(double W, double H)
+    {
+        TRACE_SCOPE("scheduleResidency");
+        int frames = ceil(timeline.duration() * TIMELINE_FPS);
+        for(int f=0; f<=frames; f++)
+        {
+            double t = f / TIMELINE_FPS, scale, cx, cy;
+            timeline.sample(t, scale, cx, cy);
+            for(auto &img: images)
+            {
+                if(img.file_name.empty())
+                    continue;
+                if(!nearView(place(img, scale, cx, cy, W, H), W, H))
+                    continue;
+                //keep it through gaps too short for dropping it and decoding it again to be worth it
+                if(!img.resident.empty() && t - RESIDENCY_LEAD <= img.resident.back().second)
+                    img.resident.back().second = t + RESIDENCY_LINGER;
+                else img.resident.push_back(make_pair(t - RESIDENCY_LEAD, t + RESIDENCY_LINGER));
+            }
+        }
+    }
+    //decodes and uploads scheduled images ahead of the timeline, and drops them once it's past them
+    void updateResidency(const Camera &cam, double W, double H)
+    {
+        int uploads = 0;
+        double t = cam.time;
+        for(auto &img: images)
+        {
+            if(img.file_name.empty() || img.broken)
+                continue;
+            bool needed = any_of(img.resident.begin(), img.resident.end(), [&](const pair<double, double> &r){return t >= r.first && t <= r.second;});
+            //the schedule only covers the timeline's path, so while it's paused whatever is in view is loaded on demand too
+            if(!needed && cam.paused)
+                needed = nearView(place(img, cam.scale, cam.x, cam.y, W, H), W, H);
+            if(!needed)
+            {
+                if(img.t != NULL)
+                {
+                    SDL_DestroyTexture(img.t);
+                    img.t = NULL;
+                    img.opaque = SDL_Rect{0, 0, 0, 0}; //it doesn't hide anything until it's loaded again
+                    impostor_first = -1;
+                }
+                img.pending.reset();
+            }
+            else if(img.t == NULL)
+            {
+                if(!img.pending)
+                    img.pending = loadSurfaceAsync(img.file_name, 0, 0, 0);
+                else if(img.pending->done && uploads < MAX_SCHEDULED_UPLOADS_PER_FRAME)
+                {
+                    if(img.pending->surface != NULL)
+                    {
+                        img.upload(*img.pending);
+                        uploads++;
+                        impostor_first = -1;
+                    }
+                    else
+                    {
+                        img.resident.clear();
+                        img.broken = true;
+                    }
+                    img.pending.reset();
+                }
+                if(img.pending)
+                    frame_loading = true;
+            }
+        }
+    }
+    //performance overlay in the top left corner; the text is drawn a character at a time so changing numbers don't create textures,
+    //and all of its characters go out in a single draw call
+    void drawHud(int visible)
+    {
+        const RenderStats &s = getRenderStats();
+        int n = std::min(s.frames, RenderStats::HISTORY);
+        int size = getFontSize(-2), w = RenderStats::HISTORY * HUD_BAR_WIDTH, pad = size / 2;
+        int y = getWindowH() / 40 + pad; //below the FPS counter
+        fillRect(0, y, w + 2*pad, HUD_GRAPH_HEIGHT + HUD_LINES * size + 3*pad, 0, 0, 0, 160);
+        //bars within the budget first and slow ones after, so each color is one batch
+        double budget = sdl_settings::frameTimeBudget;
+        static float sorted[RenderStats::HISTORY];
+        double total = 0;
+        for(int slow=0; slow<2; slow++)
+        {
+            for(int i=0; i<n; i++)
+            {
+                float ms = s.frame_ms[(s.frames - n + i) % RenderStats::HISTORY];
+                if((ms > budget) != (bool)slow)
+                    continue;
+                int h = std::min(1.0, ms / (2 * budget)) * HUD_GRAPH_HEIGHT;
+                if(slow)
+                    fillRect(pad + i*HUD_BAR_WIDTH, y + pad + HUD_GRAPH_HEIGHT - h, HUD_BAR_WIDTH, h, 255, 80, 60, 220);
+                else fillRect(pad + i*HUD_BAR_WIDTH, y + pad + HUD_GRAPH_HEIGHT - h, HUD_BAR_WIDTH, h, 80, 220, 80, 220);
+                sorted[i] = ms;
+                total += ms;
+            }
+        }
+        fillRect(pad, y + pad + HUD_GRAPH_HEIGHT / 2, w, 1, 255, 255, 255, 120); //the budget
+        double mn = 0, avg = 0, p99 = 0;
+        if(n > 0)
+        {
+            mn = *min_element(sorted, sorted + n);
+            avg = total / n;
+            int k = std::min(n - 1, (int)(n * 0.99));
+            nth_element(sorted, sorted + k, sorted + n);
+            p99 = sorted[k];
+        }
+        long long texture_bytes = s.text_cache_bytes + getTextureBytes(impostor);
+        for(auto &i: images)
+        {
+            if(i.tiles)
+                texture_bytes += i.tiles->textureBytes();
+            else if(i.t != NULL)
+                texture_bytes += 4LL * i.tw * i.th;
+        }
+        long long lookups = s.text_hits + s.text_misses;
+        char line[HUD_LINES][96];
+        snprintf(line[0], sizeof(line[0]), "frame ms min %.1f avg %.1f p99 %.1f", mn, avg, p99);
+        snprintf(line[1], sizeof(line[1]), "draw calls %d", s.draw_calls);
+        snprintf(line[2], sizeof(line[2]), "visible images %d/%d", visible, (int)images.size());
+        snprintf(line[3], sizeof(line[3]), "text cache %d %.1f MB hit %.1f%%", s.text_cache_size, s.text_cache_bytes / 1048576.0,
+                 lookups > 0? 100.0 * s.text_hits / lookups : 100.0);
+        snprintf(line[4], sizeof(line[4]), "textures %.1f MB", texture_bytes / 1048576.0);
+        snprintf(line[5], sizeof(line[5]), "pending decodes %d", getPendingSurfaceLoads());
+        snprintf(line[6], sizeof(line[6]), "allocations %d %lld B, %lld frames", s.allocs, s.alloc_bytes, s.alloc_frames);
+        for(int i=0; i<HUD_LINES; i++)
+            drawTextChars(line[i], pad, y + 2*pad + HUD_GRAPH_HEIGHT + i*size, size, 255, 255, 255);
+    }
+    //the visible image closest to the centre of the window that contains it and fits the info panel's size range, or -1
+    int centredImage(double W, double H)
+    {
+        int res = -1;
+        double best = INFINITY;
+        for(size_t i=0; i<images.size(); i++)
+        {
+            const Placement &p = placements[i];
+            if(!p.visible || p.w < W * PANEL_MIN_SIZE || p.w > W * PANEL_MAX_SIZE)
+                continue;
+            if(p.x > W/2 || p.x + p.w < W/2 || p.y > H/2 || p.y + p.h < H/2)
+                continue;
+            double d = hypot(p.x + p.w/2 - W/2, p.y + p.h/2 - H/2);
+            if(d < best)
+            {
+                best = d;
+                res = i;
+            }
+        }
+        return res;
+    }
+    //where an image goes in a W by H window at a given scale
+    Placement place(const Image &img, double scale, double cx, double cy, double W, double H)
+    {
+        Placement p;
+        p.w = W * img.w / scale;
+        p.h = p.w * img.th / img.tw;
+        p.x = W * ((img.x - cx) / scale + 0.5);
+        p.y = W * ((img.y - cy) / scale + H / 2.0 / W);
+        if(p.w >= 1e5)
+            p.alpha = std::max(0.0, 255 - 85 * log10(p.w / 1e5));
+        else p.alpha = 255;
+        p.visible = false;
+        return p;
+    }
+    //whether an image placed at p is big enough to be drawn without being faded out entirely
+    static bool drawable(const Placement &p)
+    {
+        return p.w < 1e8 && p.h < 1e8 && p.alpha > 0 && max(p.w, p.h) >= MIN_IMAGE_SIZE;
+    }
+    //whether an image placed at p would be drawn in a W by H view, or nearly (within RESIDENCY_VIEW_MARGIN)
+    static bool nearView(const Placement &p, double W, double H)
+    {
+        double mx = W * (RESIDENCY_VIEW_MARGIN - 1) / 2, my = H * (RESIDENCY_VIEW_MARGIN - 1) / 2;
+        return drawable(p) && p.x <= W + mx && p.y <= H + my && p.x + p.w >= -mx && p.y + p.h >= -my;
+    }
+    //star fields are behind every image, so they're drawn first, into the background layer when there is one
+    void drawStarFields(double scale, double cx, double cy, double W, double H)
     {
+        for(auto &s: star_fields)
+            s.cloud.render(W * ((s.x - cx) / scale + 0.5), W * (s.y - cy) / scale + H / 2.0, W * s.w / scale, W, H);
+    }
+    //redraws the background layer if the cached one can no longer stand in for it, returns false if there is no background layer
+    bool updateImpostor(double scale, double cx, double cy, double W, double H)
+    {
+        int first = images.size();
+        while(first > 0 && images[first-1].w / scale >= IMPOSTOR_MIN_SIZE)
+            first--;
+        int w = W * IMPOSTOR_MARGIN, h = H * IMPOSTOR_MARGIN;
+        double f = impostor_scale / scale; //how much the cached layer has to be stretched
+        //panning moves the cached layer off centre, so it has to be stretched more to still cover the window
+        double shift = 2 * max(fabs(impostor_x - cx) / scale, fabs(impostor_y - cy) / scale * W / H);
+        impostor_age++;
+        if(first==impostor_first && w==impostor_w && h==impostor_h && f>=1+shift && f<=IMPOSTOR_MARGIN*IMPOSTOR_MARGIN &&
+           impostor_age<=IMPOSTOR_MAX_AGE && !impostor_loading)
+            return first < (int)images.size();
+        impostor_first = first;
+        if(first == (int)images.size())
+            return false;
+        if(impostor == NULL || w != impostor_w || h != impostor_h)
+        {
+            if(impostor != NULL)
+                SDL_DestroyTexture(impostor);
+            impostor = SDL_CreateTexture(getRenderer(), SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+            impostor_w = w;
+            impostor_h = h;
+            if(impostor == NULL)
+                return false;
+        }
+        //zoomed out by the margin so there's room to keep using it while the camera zooms out
+        impostor_scale = scale * IMPOSTOR_MARGIN;
+        impostor_x = cx;
+        impostor_y = cy;
+        impostor_age = 0;
+        setRenderTarget(impostor);
         renderClear(0, 0, 0);
-        for(int i=images.size()-1; i>=0; i--)
+        drawStarFields(impostor_scale, cx, cy, w, h);
+        impostor_loading = false;
+        for(int i=images.size()-1; i>=first; i--)
         {
-            double w = getWindowW() * images[i].w / scale;
-            int iW, iH;
-            SDL_QueryTexture(images[i].t, NULL, NULL, &iW, &iH);
-            double h = w * iH / iW;
-            double x = getWindowW() * (images[i].x / scale + 0.5);
-            double y = getWindowW() * (images[i].y / scale + getWindowH() / 2.0 / getWindowW());
-            if(w<1e8 && h<1e8)
+            Placement p = place(images[i], impostor_scale, cx, cy, w, h);
+            if(drawable(p) && images[i].draw(p, w, h))
+                impostor_loading = true;
+        }
+        frame_loading |= impostor_loading;
+        setRenderTarget(NULL);
+        return true;
+    }
+    //screen rectangle and font size of a label this frame, returns false if it would be too small to read
+    bool placeLabel(const Label &l, double min_size, double max_size, ScreenRect &r, int &size)
+    {
+        const Placement &p = placements[l.image];
+        double natural = sqrt(p.w * p.h) / 5;
+        if(natural < min_size)
+            return false;
+        size = min(natural, max_size);
+        double y = l.anchor==LABEL_TOP? p.y : p.y + p.h - size;
+        r = ScreenRect{p.x, y, p.x + images[l.image].name.size() * size / 2.0, y + size};
+        return true;
+    }
+    //greedily picks non overlapping labels, most prominent first, trying the bottom then the top of each image
+    void layoutLabels(double W, double H, double min_size, double max_size)
+    {
+        labels.clear();
+        label_rects.clear();
+        label_order.clear();
+        for(size_t i=0; i<images.size(); i++)
+            if(placements[i].visible)
+                label_order.push_back(i);
+        sort(label_order.begin(), label_order.end(), [&](int a, int b){return placements[a].w * placements[a].h > placements[b].w * placements[b].h;});
+        int cols = ceil(W / max_size), rows = ceil(H / max_size);
+        label_grid.resize(cols * rows);
+        for(auto &i: label_grid)
+            i.clear();
+        for(int i: label_order)
+        {
+            for(int anchor: {LABEL_BOTTOM, LABEL_TOP})
             {
-                uint8_t alpha;
-                if(w >= 1e5)
-                    alpha = std::max(0.0, 255 - 85 * log10(w / 1e5));
-                else alpha = 255;
-                SDL_SetTextureAlphaMod(images[i].t, alpha);
-                renderCopy(images[i].t, x, y, w, h);
-                int fsz = sqrt(w * h) / 5;
-                drawText(images[i].name, x, y + h - fsz, fsz, 255, 255, 255);
+                Label l{i, anchor};
+                ScreenRect r;
+                int size;
+                if(!placeLabel(l, min_size, max_size, r, size))
+                    break;
+                ScreenRect c = r.clip(W, H);
+                if(c.empty()) //off screen for now, but it may come into view before the band changes
+                {
+                    labels.push_back(l);
+                    break;
+                }
+                int cx1 = c.x1 / max_size, cy1 = c.y1 / max_size;
+                int cx2 = min(cols - 1, (int)(c.x2 / max_size)), cy2 = min(rows - 1, (int)(c.y2 / max_size));
+                bool overlaps = false;
+                for(int y=cy1; y<=cy2 && !overlaps; y++)
+                    for(int x=cx1; x<=cx2 && !overlaps; x++)
+                        for(int j: label_grid[y*cols + x])
+                            if(label_rects[j].intersects(r))
+                                overlaps = true;
+                if(overlaps)
+                    continue;
+                for(int y=cy1; y<=cy2; y++)
+                    for(int x=cx1; x<=cx2; x++)
+                        label_grid[y*cols + x].push_back(label_rects.size());
+                label_rects.push_back(r);
+                labels.push_back(l);
+                break;
             }
         }
+    }
+    //only reads images and cam, so it can run on the render thread while play() and input run on the main thread
+    void render(const Camera &cam)
+    {
+        TRACE_SCOPE("render");
+        double scale = cam.scale, cx = cam.x, cy = cam.y;
+        double W = getWindowW(), H = getWindowH();
+        frame_loading = false;
+        updateShards(scale, cx, cy, W, H);
+        if(!timeline.keys.empty())
+            updateResidency(cam, W, H);
+        //place images front to back first, so anything hidden behind opaque images that are drawn later can be skipped
+        placements.resize(images.size());
+        occluders.clear();
+        for(size_t i=0; i<images.size(); i++)
+        {
+            Placement &p = placements[i];
+            p = place(images[i], scale, cx, cy, W, H);
+            if(!drawable(p))
+                continue;
+            ScreenRect r = ScreenRect{p.x, p.y, p.x + p.w, p.y + p.h}.clip(W, H);
+            if(r.empty() || any_of(occluders.begin(), occluders.end(), [&](const ScreenRect &o){return o.contains(r);}))
+                continue;
+            p.visible = true;
+            const SDL_Rect &o = images[i].opaque;
+            if(p.alpha == 255 && o.w > 0)
+            {
+                //stay a texel and a pixel inside the opaque part, since filtering blends its edges with their neighbors
+                double tx = p.w / images[i].tw, ty = p.h / images[i].th;
+                ScreenRect c = ScreenRect{p.x + (o.x + 1) * tx + 1, p.y + (o.y + 1) * ty + 1,
+                                          p.x + (o.x + o.w - 1) * tx - 1, p.y + (o.y + o.h - 1) * ty - 1}.clip(W, H);
+                if(!c.empty())
+                    occluders.push_back(c);
+            }
+        }
+        bool covered = any_of(occluders.begin(), occluders.end(), [&](const ScreenRect &o){return o.contains(ScreenRect{0, 0, W, H});});
+        bool use_impostor = !covered && updateImpostor(scale, cx, cy, W, H);
+        //images may be drawn at reduced resolution, labels and the scale bar are always drawn at native resolution
+        beginScaledRender();
+        renderClear(0, 0, 0);
+        if(use_impostor)
+        {
+            double f = impostor_scale / scale, dx = W * (impostor_x - cx) / scale, dy = W * (impostor_y - cy) / scale;
+            renderCopy(impostor, dx + W/2 * (1 - f), dy + H/2 * (1 - f), W * f, H * f);
+        }
+        else if(!covered)
+            drawStarFields(scale, cx, cy, W, H);
+        for(int i=images.size()-1; i>=0; i--)
+        {
+            const Placement &p = placements[i];
+            if(!p.visible)
+                continue;
+            if((!use_impostor || i < impostor_first) && images[i].draw(p, W, H))
+                frame_loading = true;
+        }
+        endScaledRender();
+        for(auto &o: orbits)
+            drawRing(W * ((o.x - cx) / scale + 0.5), W * (o.y - cy) / scale + H / 2.0, W * o.r / scale, ORBIT_R, ORBIT_G, ORBIT_B, ORBIT_A);
+        //label sizes are clamped so huge images don't get huge labels
+        double min_size = getFontSize(-2), max_size = getFontSize(2);
+        int band = floor(log10(scale) * LABEL_BANDS_PER_DECADE);
+        if(band != label_band || W != label_w || H != label_h || max(fabs(cx - label_x), fabs(cy - label_y)) > scale * LABEL_PAN_STEP)
+        {
+            label_band = band;
+            label_w = W;
+            label_h = H;
+            label_x = cx;
+            label_y = cy;
+            layoutLabels(W, H, min_size, max_size);
+        }
+        for(auto &l: labels)
+        {
+            ScreenRect r;
+            int size;
+            if(placements[l.image].visible && placeLabel(l, min_size, max_size, r, size) && !r.clip(W, H).empty())
+                drawText(images[l.image].name, r.x1, r.y1, size, 255, 255, 255);
+        }
+        int c = centredImage(W, H);
+        if(c >= 0 && !images[c].description_file.empty())
+        {
+            images[c].description = loadDescription(images[c].description_file);
+            images[c].description_file.clear();
+        }
+        if(c >= 0 && !images[c].description.empty())
+        {
+            int size = getFontSize(-1), pad = size / 2, w = W * PANEL_WIDTH;
+            layoutText(panel, images[c].description, w - 2*pad, size);
+            fillRect(W - w - pad, pad, w, panel.lines.size() * size + 2*pad, 0, 0, 0, 160);
+            drawTextLayout(panel, W - w, 2*pad, 255, 255, 255);
+        }
         fillRect(getWindowW() * 0.1, getWindowH() * 0.1, getWindowW() * 0.1, getWindowH() * 0.01, 255, 255, 255);
+        //the text changes every frame while zooming, so it's drawn a character at a time to avoid creating textures and strings
         int e = floor(log10(scale * 0.1));
-        string b = to_str((int)(scale / pow(10, e)) / 10.0);
-        if(b.size() == 1)
-            b += '.';
-        while(b.size() < 3)
-            b += '0';
-        drawText(b + "e" + to_str(e) + " m", getWindowW() * 0.1, getWindowH() * 0.11, getFontSize(0), 255, 255, 255);
+        char b[32];
+        snprintf(b, sizeof(b), "%.1fe%d m", (int)(scale / pow(10, e)) / 10.0, e);
+        drawTextChars(b, getWindowW() * 0.1, getWindowH() * 0.11, getFontSize(0), 255, 255, 255);
+        if(show_hud)
+            drawHud(count_if(placements.begin(), placements.end(), [](const Placement &p){return p.visible;}));
+        loading = frame_loading;
     }
     Displayer(const char *file_name)
     {
-        ifstream fin(file_name);
+        TRACE_SCOPE("loadScene");
+        auto in = openAsset(file_name);
+        istream &fin = *in;
         string prefix;
         fin >> scale >> end_scale >> scale_per_frame >> prefix;
+        target_scale = scale;
         string fname, name;
         is_paused = false;
         double x, y, w;
-        while(!fin.eof())
+        vector<PendingImage> top; //loaded once it's known whether there's a timeline
+        while(fin >> fname)
+        {
+            if(fname == "keyframe") //keyframe time scale x y dwell linear|smooth
+            {
+                Keyframe k;
+                fin >> k.time >> k.scale >> k.x >> k.y >> k.dwell >> name;
+                k.easing = name == "smooth"? EASE_SMOOTH : EASE_LINEAR;
+                timeline.keys.push_back(k);
+                continue;
+            }
+            if(fname == "include") //include file min_scale max_scale x y w h
+            {
+                Shard s;
+                fin >> s.file_name >> s.min_scale >> s.max_scale >> s.x >> s.y >> s.w >> s.h;
+                shards.push_back(s);
+                continue;
+            }
+            if(fname == "starfield") //starfield count seed x y w
+            {
+                int count;
+                unsigned seed;
+                StarField s;
+                fin >> count >> seed >> s.x >> s.y >> s.w;
+                s.cloud.generate(count, seed);
+                star_fields.push_back(move(s));
+                continue;
+            }
+            if(fname == "orbit") //orbit x y radius
+            {
+                Orbit o;
+                fin >> o.x >> o.y >> o.r;
+                orbits.push_back(o);
+                continue;
+            }
+            if(fname == "catalog") //catalog file unit x y, catalog positions are multiplied by unit and offset by (x, y)
+            {
+                double unit;
+                StarField s;
+                fin >> fname >> unit >> x >> y;
+                if(s.cloud.loadCatalog(prefix + "/" + fname, s.x, s.y, s.w))
+                {
+                    s.x = x + s.x * unit;
+                    s.y = y + s.y * unit;
+                    s.w *= unit;
+                    star_fields.push_back(move(s));
+                }
+                else logError("Failed to load catalog %s/%s", prefix, fname);
+                continue;
+            }
+            fin >> name >> x >> y >> w; //h can be calculated from w
+            top.push_back(PendingImage{prefix + "/" + fname, name, x, y, w, nullptr, descriptionFile(prefix, name)});
+        }
+        stable_sort(timeline.keys.begin(), timeline.keys.end(), [](const Keyframe &a, const Keyframe &b){return a.time < b.time;});
+        for(auto &p: top)
+        {
+            if(isDeepZoom(p.file_name))
+                images.push_back(Image::fromDeepZoom(p.file_name, p.name, p.x, p.y, p.w, -1));
+            else
+            {
+                images.emplace_back(p.name, p.x, p.y, p.w, -1);
+                //decoded on all the decoder threads at once, which also find their opaque parts. With a timeline, images are decoded
+                //on a schedule instead of up front, so only their size is read now.
+                if(timeline.keys.empty())
+                    p.surface = loadSurfaceAsync(p.file_name, 0, 0, 0);
+                else
+                {
+                    images.back().file_name = p.file_name;
+                    if(!getImageSize(p.file_name, images.back().tw, images.back().th))
+                        logError("Failed to read the size of %s", p.file_name);
+                }
+            }
+            images.back().description_file = move(p.description_file);
+        }
+        for(int i=top.size()-1; i>=0; i--) //the decoders take the most recently queued files first
+        {
+            if(top[i].surface)
+            {
+                waitForSurface(*top[i].surface);
+                images[i].upload(*top[i].surface);
+                top[i].surface.reset();
+            }
+        }
+        if(!timeline.keys.empty())
         {
-            fin >> fname >> name >> x >> y >> w; //h can be calculated from w
-            images.emplace_back((prefix + "/" + fname).c_str(), name, x, y, w);
+            timeline.sample(0, scale, pan_x, pan_y);
+            target_scale = scale;
+            scheduleResidency(getWindowW(), getWindowH());
         }
     }
     Displayer(){}
 };
+static const int IDLE_WAIT_TIMEOUT = 500; //ms to block for events when nothing on screen is changing
+static const int INPUT_WAIT_TIMEOUT = 1; //ms to block for events while a frame is pending
+static atomic<bool> running(true);
+//set by the render thread once it has presented and can take a new camera. The main thread steps in lockstep with it, so play() runs
+//once per presented frame and camera_buffer only ever holds one camera in flight; the triple buffer just hands it over without locking.
+static atomic<bool> frame_ready(true);
+static SDL_sem *frame_requested;
+static TripleBuffer<Camera> camera_buffer;
+static LatencyStats latency;
+static atomic<bool> time_frames(false); //set while replaying, to collect frame_times
+static vector<long long> frame_times; //ns to draw and present each frame, only touched by the render thread until it's joined
+static InputRecorder recorder;
+static uint32_t steps = 0; //frames handed to the render thread so far, which events in input logs are tagged with
+//all SDL rendering happens here once the scene is loaded
+static void renderLoop(Displayer *d)
+{
+    traceThreadName("render");
+    acquireRenderer();
+    while(true)
+    {
+        SDL_SemWait(frame_requested);
+        if(!running)
+            break;
+        bool fresh = camera_buffer.update();
+        long long start = getTicksNs();
+        d->render(camera_buffer.getReadBuffer());
+        updateScreen();
+        if(time_frames)
+            frame_times.push_back(getTicksNs() - start);
+        if(fresh)
+            latency.presented(camera_buffer.getReadBuffer());
+        frame_ready = true;
+    }
+    releaseRenderer();
+}
+//returns true if the event changes what's on screen
+static bool handleEvent(Displayer &d, const SDL_Event &e)
+{
+    //shift is tracked from the events rather than read from the keyboard state, so replayed input behaves the same
+    static bool shift = false;
+    switch(e.type)
+    {
+    case SDL_QUIT:
+        running = false;
+        break;
+    case SDL_KEYDOWN:
+        if(e.key.keysym.sym == SDLK_LSHIFT)
+            shift = true;
+        if(e.key.keysym.sym == SDLK_SPACE)
+        {
+            latency.stamp();
+            d.is_paused = !d.is_paused;
+            return true;
+        }
+        if(e.key.keysym.sym == SDLK_F3)
+        {
+            show_hud = !show_hud;
+            return true;
+        }
+        if(e.key.keysym.sym == SDLK_F12)
+        {
+            takeScreenshot("screenshot_" + to_str(time(NULL)) + ".png");
+            return true;
+        }
+        if(e.key.keysym.sym == SDLK_F11)
+        {
+            static bool recording = false;
+            recording = !recording;
+            if(!recording)
+                stopCapture();
+            else startCapture("capture_" + to_str(time(NULL)) + "_");
+            return true;
+        }
+        break;
+    case SDL_KEYUP:
+        if(e.key.keysym.sym == SDLK_LSHIFT)
+            shift = false;
+        break;
+    case SDL_MOUSEWHEEL:
+        latency.stamp();
+        if(shift)
+            d.zoom(pow(d.scale_per_frame, -35 * e.wheel.y));
+        else d.zoom(pow(d.scale_per_frame, -7 * e.wheel.y));
+        return true;
+    case SDL_WINDOWEVENT:
+        if(e.window.event == SDL_WINDOWEVENT_FOCUS_LOST) //the key up would go to another window
+            shift = false;
+        return e.window.event == SDL_WINDOWEVENT_EXPOSED || e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED;
+    }
+    return false;
+}
+//keys that toggle the HUD, screenshots and capture; they don't change the scale, and a replay shouldn't write files
+static bool isToolKey(const SDL_Event &e)
+{
+    if(e.type != SDL_KEYDOWN && e.type != SDL_KEYUP)
+        return false;
+    SDL_Keycode k = e.key.keysym.sym;
+    return k == SDLK_F3 || k == SDLK_F11 || k == SDLK_F12;
+}
+//advances one step and hands the result to the render thread, which must have taken the last one
+static void step(Displayer &d)
+{
+    d.play();
+    camera_buffer.getWriteBuffer() = d.getCamera();
+    latency.attach(camera_buffer.getWriteBuffer());
+    camera_buffer.publish();
+    SDL_SemPost(frame_requested);
+    if(recorder.isOpen())
+        recorder.stepped(steps, d.scale);
+    steps++;
+}
+static const int REPLAY_POLL_INTERVAL = 100; //us to sleep while waiting for the next event's time or for the render thread
+//feeds a recorded input log back in, at the recorded times unless fast is set; returns the number of steps whose scale differed
+static int replayInput(Displayer &d, const vector<InputLogEntry> &log, bool fast)
+{
+    int diverged = 0;
+    long long start = getTicksNs();
+    for(size_t i=0; i<log.size() && running; )
+    {
+        SDL_Event e;
+        while(SDL_PollEvent(&e)) //the window is hidden, so this only lets the replay be stopped
+        {
+            if(e.type == SDL_QUIT)
+                running = false;
+        }
+        const InputLogEntry &n = log[i];
+        bool early = !fast && getTicksNs() - start < n.ns;
+        if(!early && !n.is_step)
+        {
+            if(!isToolKey(n.event))
+                handleEvent(d, n.event);
+            i++;
+        }
+        else if(!early && frame_ready.exchange(false))
+        {
+            step(d);
+            if(d.scale != n.scale)
+                diverged++;
+            i++;
+        }
+        else this_thread::sleep_for(chrono::microseconds(REPLAY_POLL_INTERVAL));
+    }
+    while(!frame_ready)
+        this_thread::sleep_for(chrono::microseconds(REPLAY_POLL_INTERVAL));
+    return diverged;
+}
+static void reportFrameTimes(long long total_ns, int diverged)
+{
+    if(frame_times.empty())
+        return;
+    sort(frame_times.begin(), frame_times.end());
+    auto ms = [&](double p)
+    {
+        return frame_times[min(frame_times.size() - 1, (size_t)(p * frame_times.size()))] / 1e6;
+    };
+    logInfo("Replayed %d frames in %.2f s (%.1f FPS): p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms", (int)frame_times.size(),
+            total_ns / 1e9, frame_times.size() / (total_ns / 1e9), ms(0.5), ms(0.9), ms(0.99), ms(1));
+    if(diverged > 0)
+        logWarning("The scale differed from the recording after %d steps", diverged);
+}
 int main(int argc, char **argv)
 {
     sdl_settings::load_config();
-    initSDL("Scale");
-    atexit(SDL_Quit);
+    initSDL("Scale"); //also registers SDL's shutdown with atexit
     atexit(sdl_settings::output_config);
-    Displayer d;
-    if(argc == 2)
-        d = Displayer(argv[1]);
-    else d = Displayer("data.txt");
-    while(true)
+    showLoadingScreen(); //the scene can take a while to load
+    //scale [scene file] [--shm name] [--hidden] [--record log] [--replay log [--fast]]
+    //a replay is headless and reports frame timings; --fast replays as fast as possible instead of at the recorded times
+    const char *scene = NULL, *record_file = NULL, *replay_file = NULL;
+    bool fast = false;
+    for(int i=1; i<argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--shm" && i+1 < argc)
+            startSharedMemoryOutput(argv[++i]);
+        else if(arg == "--hidden")
+            setWindowVisible(false);
+        else if(arg == "--record" && i+1 < argc)
+            record_file = argv[++i];
+        else if(arg == "--replay" && i+1 < argc)
+            replay_file = argv[++i];
+        else if(arg == "--fast")
+            fast = true;
+        else scene = argv[i];
+    }
+    InputLogHeader header;
+    vector<InputLogEntry> replay_log;
+    if(replay_file != NULL)
+    {
+        if(!loadInputLog(replay_file, header, replay_log))
+            return 1;
+        if(scene == NULL)
+            scene = header.scene.c_str();
+        setWindowVisible(false);
+        SDL_SetWindowSize(getWindow(), header.window_w, header.window_h);
+    }
+    if(scene == NULL)
+        scene = "data.txt";
+    Displayer d(scene);
+    if(replay_file != NULL)
+    {
+        d.scale = header.scale;
+        d.target_scale = header.target_scale;
+        d.is_paused = header.paused;
+    }
+    if(record_file != NULL)
+        recorder.open(record_file, InputLogHeader{scene, getWindowW(), getWindowH(), d.scale, d.target_scale, d.is_paused});
+    frame_requested = SDL_CreateSemaphore(0);
+    releaseRenderer(); //everything was loaded with it current here, but from now on only the render thread draws
+    thread render_thread(renderLoop, &d);
+    int diverged = 0;
+    long long replay_start = getTicksNs();
+    if(replay_file != NULL)
     {
-        while(SDL_PollEvent(&input))
+        frame_times.reserve(replay_log.size()); //so collecting them doesn't allocate on the render thread
+        time_frames = true;
+        diverged = replayInput(d, replay_log, fast);
+        running = false;
+    }
+    bool redraw = true;
+    while(running)
+    {
+        //keep sampling input while the render thread works, but don't spin while paused or finished; sleep until something happens
+        if(SDL_WaitEventTimeout(&input, redraw || !d.isStatic() || isCapturing() || show_hud ? INPUT_WAIT_TIMEOUT : IDLE_WAIT_TIMEOUT))
         {
-            switch(input.type)
+            do
             {
-            case SDL_QUIT:
-                exit(0);
-                break;
-            case SDL_KEYDOWN:
-                if(input.key.keysym.sym == SDLK_SPACE)
-                    d.is_paused = !d.is_paused;
-                break;
-            case SDL_MOUSEWHEEL:
-                if(SDL_GetKeyboardState(NULL)[SDL_SCANCODE_LSHIFT])
-                    d.scale *= pow(d.scale_per_frame, -35 * input.wheel.y);
-                else d.scale *= pow(d.scale_per_frame, -7 * input.wheel.y);
-                break;
+                if(recorder.isOpen())
+                    recorder.event(steps, input);
+                redraw |= handleEvent(d, input);
             }
+            while(SDL_PollEvent(&input));
+        }
+        //advance one step per presented frame and hand the result to the render thread
+        if((redraw || !d.isStatic() || isCapturing() || show_hud) && frame_ready.exchange(false))
+        {
+            step(d);
+            redraw = false;
         }
-        d.play();
-        d.render();
-        updateScreen();
     }
+    SDL_SemPost(frame_requested);
+    render_thread.join();
+    acquireRenderer(); //so the renderer can be torn down at exit
+    finishCaptures();
+    SDL_DestroySemaphore(frame_requested);
+    if(replay_file != NULL)
+        reportFrameTimes(getTicksNs() - replay_start, diverged);
+    latency.report();
+    const RenderStats &s = getRenderStats();
+    logInfo("%lld of %d frames made heap allocations on the render thread", s.alloc_frames, s.frames);
     return 0;
 }
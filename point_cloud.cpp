@@ -0,0 +1,376 @@
+//Point clouds with merged levels of detail, for star fields
+#include "point_cloud.h"
+#include "assets.h"
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <future>
+#include <deque>
+#include <thread>
+#include <cstdlib>
+#include <cctype>
+PointCloud::PointCloud(): limit_mag(6), levels(1){}
+/**
+Adds a point, with x and y from 0 to 1 across the cloud. build() has to be called once all points are added.
+*/
+void PointCloud::addPoint(float x, float y, float mag, uint32_t color)
+{
+    Level &l = levels[0];
+    l.x.push_back(x);
+    l.y.push_back(y);
+    l.mag.push_back(mag);
+    l.color.push_back(color);
+}
+template<class T> static void permute(std::vector<T> &v, const std::vector<uint32_t> &order)
+{
+    std::vector<T> res(v.size());
+    for(size_t i=0; i<order.size(); i++)
+        res[i] = v[order[i]];
+    v.swap(res);
+}
+/**
+Sorts a level's points by grid row and then by x, and fills in row_start
+*/
+static void sortLevel(PointCloud::Level &l)
+{
+    auto row = [&](uint32_t i)
+    {
+        return std::min(l.res - 1, (int)(l.y[i] * l.res));
+    };
+    std::vector<uint32_t> order(l.x.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        int ra = row(a), rb = row(b);
+        return ra!=rb? ra<rb : l.x[a]<l.x[b];
+    });
+    permute(l.x, order);
+    permute(l.y, order);
+    permute(l.mag, order);
+    permute(l.color, order);
+    l.row_start.assign(l.res + 1, 0);
+    for(uint32_t i=0; i<l.x.size(); i++)
+        l.row_start[row(i) + 1]++;
+    std::partial_sum(l.row_start.begin(), l.row_start.end(), l.row_start.begin());
+}
+/**
+Merges the points of a level in each cell of a res by res grid, weighting position and color by brightness
+*/
+static PointCloud::Level mergeLevel(const PointCloud::Level &f, int res)
+{
+    PointCloud::Level c;
+    c.res = res;
+    std::vector<std::pair<uint64_t, uint32_t> > cells(f.x.size());
+    for(uint32_t i=0; i<f.x.size(); i++)
+    {
+        uint64_t cx = std::min(res - 1, (int)(f.x[i] * res)), cy = std::min(res - 1, (int)(f.y[i] * res));
+        cells[i] = std::make_pair(cy * res + cx, i);
+    }
+    std::sort(cells.begin(), cells.end());
+    for(size_t i=0, j; i<cells.size(); i=j)
+    {
+        double flux = 0, x = 0, y = 0, r = 0, g = 0, b = 0;
+        for(j=i; j<cells.size() && cells[j].first==cells[i].first; j++)
+        {
+            uint32_t k = cells[j].second;
+            double p = std::pow(10.0, -0.4 * f.mag[k]);
+            flux += p;
+            x += f.x[k] * p;
+            y += f.y[k] * p;
+            r += (f.color[k] >> 16 & 255) * p;
+            g += (f.color[k] >> 8 & 255) * p;
+            b += (f.color[k] & 255) * p;
+        }
+        c.x.push_back(x / flux);
+        c.y.push_back(y / flux);
+        c.mag.push_back(-2.5 * std::log10(flux));
+        c.color.push_back((uint32_t)(r / flux) << 16 | (uint32_t)(g / flux) << 8 | (uint32_t)(b / flux));
+    }
+    sortLevel(c);
+    return c;
+}
+/**
+Sorts the points and builds the merged levels
+*/
+void PointCloud::build()
+{
+    levels.resize(1);
+    Level &l0 = levels[0];
+    //the finest grid has a few cells per point, so rows stay short
+    int depth = std::max(0, (int)std::ceil(std::log2(std::sqrt((double)l0.x.size()))) + 1);
+    l0.res = 1 << depth;
+    sortLevel(l0);
+    for(int res = l0.res/2; res >= 1; res /= 2)
+        levels.push_back(mergeLevel(levels.back(), res));
+}
+/**
+Adds count randomly placed stars in a two armed spiral, and builds the cloud
+*/
+void PointCloud::generate(int count, unsigned seed)
+{
+    const double PI = std::acos(-1.0);
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> u(0, 1);
+    std::normal_distribution<double> n(0, 1);
+    std::exponential_distribution<double> radius(1 / 0.12);
+    for(int i=0; i<count; )
+    {
+        double r = radius(gen), a, bv = 0.6 + 0.4*n(gen), kind = u(gen);
+        if(kind < 0.15) //bulge of older, redder stars
+        {
+            r *= 0.25;
+            a = 2 * PI * u(gen);
+            bv += 0.4;
+        }
+        else if(kind < 0.75) //logarithmic spiral arms
+            a = (u(gen) < 0.5? 0 : PI) + std::log(r + 0.01) / std::tan(0.3) + 0.25*n(gen);
+        else a = 2 * PI * u(gen);
+        double x = 0.5 + r*std::cos(a), y = 0.5 + r*std::sin(a);
+        if(x<0 || x>=1 || y<0 || y>=1)
+            continue;
+        //there are about twice as many stars per magnitude fainter, down to magnitude 12
+        double mag = std::max(-1.0, 12 + std::log10(1 - u(gen)) / 0.3);
+        addPoint(x, y, mag, starColor(bv));
+        i++;
+    }
+    build();
+}
+struct CatalogColumns
+{
+    int x = -1, y = -1, mag = -1, size = -1, bv = -1, count = 0;
+};
+//rows of a catalog chunk that have valid positions, value is the magnitude or size
+struct CatalogChunk
+{
+    std::vector<double> x, y, value, bv;
+};
+static CatalogColumns parseHeader(const std::string &line)
+{
+    CatalogColumns res;
+    size_t start = 0;
+    while(start <= line.size())
+    {
+        size_t end = std::min(line.find(',', start), line.size());
+        std::string name;
+        for(size_t i=start; i<end; i++)
+        {
+            if(!std::isspace((unsigned char)line[i]))
+                name += std::tolower((unsigned char)line[i]);
+        }
+        if(name == "x")
+            res.x = res.count;
+        else if(name == "y")
+            res.y = res.count;
+        else if(name == "mag")
+            res.mag = res.count;
+        else if(name == "size")
+            res.size = res.count;
+        else if(name == "bv")
+            res.bv = res.count;
+        res.count++;
+        start = end + 1;
+    }
+    return res;
+}
+/**
+Parses the field at p and moves p to the comma or newline after it, returns NaN for empty or non numeric fields
+*/
+static double parseField(const char *&p, const char *end)
+{
+    double res = NAN;
+    while(p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if(p < end && *p != ',' && *p != '\n' && *p != '\r')
+    {
+        char *next;
+        res = std::strtod(p, &next);
+        if(next == p)
+            res = NAN;
+        p = next;
+    }
+    while(p < end && *p != ',' && *p != '\n')
+        p++;
+    return res;
+}
+/**
+Parses whole lines of a catalog
+*/
+static CatalogChunk parseChunk(std::string text, CatalogColumns cols)
+{
+    CatalogChunk res;
+    std::vector<double> fields(cols.count);
+    int value = cols.mag >= 0? cols.mag : cols.size;
+    const char *p = text.c_str(), *end = p + text.size();
+    while(p < end)
+    {
+        std::fill(fields.begin(), fields.end(), NAN);
+        for(int i=0; ; i++)
+        {
+            double v = parseField(p, end);
+            if(i < cols.count)
+                fields[i] = v;
+            if(p >= end || *p == '\n')
+                break;
+            p++;
+        }
+        p++;
+        if(std::isnan(fields[cols.x]) || std::isnan(fields[cols.y]) || (value >= 0 && std::isnan(fields[value])))
+            continue;
+        res.x.push_back(fields[cols.x]);
+        res.y.push_back(fields[cols.y]);
+        res.value.push_back(value >= 0? fields[value] : 0);
+        res.bv.push_back(cols.bv >= 0? fields[cols.bv] : NAN);
+    }
+    return res;
+}
+/**
+Loads a CSV catalog and builds the cloud. The header names the columns, x and y are required, mag gives magnitudes (otherwise a
+size column makes larger objects brighter), and bv gives B-V color indices. Sets (x, y, w) to the square the catalog covers in
+its own units, returns false if the catalog can't be read.
+*/
+bool PointCloud::loadCatalog(const std::string &file_name, double &x, double &y, double &w)
+{
+    auto in = openAsset(file_name, std::ios::binary);
+    std::istream &fin = *in;
+    std::string header;
+    if(!std::getline(fin, header))
+        return false;
+    CatalogColumns cols = parseHeader(header);
+    if(cols.x < 0 || cols.y < 0)
+        return false;
+    //chunks are cut at line ends and parsed in parallel while the next ones are read, keeping only a few in memory at a time
+    size_t threads = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+    std::deque<std::future<CatalogChunk> > parsing;
+    std::vector<CatalogChunk> chunks;
+    std::string carry;
+    while(fin)
+    {
+        std::string text = carry;
+        text.resize(carry.size() + CATALOG_CHUNK_SIZE);
+        fin.read(&text[carry.size()], CATALOG_CHUNK_SIZE);
+        text.resize(carry.size() + fin.gcount());
+        carry.clear();
+        if(fin)
+        {
+            size_t cut = text.rfind('\n');
+            if(cut == std::string::npos)
+            {
+                carry.swap(text);
+                continue;
+            }
+            carry = text.substr(cut + 1);
+            text.resize(cut + 1);
+        }
+        parsing.push_back(std::async(std::launch::async, parseChunk, std::move(text), cols));
+        if(parsing.size() >= threads)
+        {
+            chunks.push_back(parsing.front().get());
+            parsing.pop_front();
+        }
+    }
+    for(auto &f: parsing)
+        chunks.push_back(f.get());
+    double x1 = INFINITY, y1 = INFINITY, x2 = -INFINITY, y2 = -INFINITY, min_size = INFINITY;
+    for(auto &c: chunks)
+    {
+        for(size_t i=0; i<c.x.size(); i++)
+        {
+            x1 = std::min(x1, c.x[i]);
+            x2 = std::max(x2, c.x[i]);
+            y1 = std::min(y1, c.y[i]);
+            y2 = std::max(y2, c.y[i]);
+            if(c.value[i] > 0)
+                min_size = std::min(min_size, c.value[i]);
+        }
+    }
+    if(x1 > x2)
+        return false;
+    //slightly larger than the bounds, so every point is below 1 after scaling
+    x = x1;
+    y = y1;
+    w = std::max(x2 - x1, y2 - y1) * (1 + 1e-6);
+    if(w <= 0)
+        w = 1;
+    levels.assign(1, Level());
+    for(auto &c: chunks)
+    {
+        for(size_t i=0; i<c.x.size(); i++)
+        {
+            double mag = limit_mag;
+            if(cols.mag >= 0)
+                mag = c.value[i];
+            else if(cols.size >= 0 && c.value[i] > 0) //brightness proportional to area
+                mag = limit_mag - 5 * std::log10(c.value[i] / min_size);
+            addPoint((c.x[i] - x) / w, (c.y[i] - y) / w, mag, std::isnan(c.bv[i])? 0xffffff : starColor(c.bv[i]));
+        }
+        c = CatalogChunk();
+    }
+    build();
+    return true;
+}
+/**
+Draws the cloud at (x, y) with size w by w, clipped to a view_w by view_h target
+*/
+void PointCloud::render(double x, double y, double w, int view_w, int view_h)
+{
+    if(levels[0].x.empty())
+        return;
+    size_t k = 0;
+    while(k + 1 < levels.size() && w / levels[k+1].res <= LOD_CELL_PIXELS)
+        k++;
+    const Level &l = levels[k];
+    double u1 = std::max(0.0, -x / w), u2 = std::min(1.0, (view_w - x) / w);
+    double v1 = std::max(0.0, -y / w), v2 = std::min(1.0, (view_h - y) / w);
+    if(u1>=u2 || v1>=v2)
+        return;
+    int r1 = v1 * l.res, r2 = std::min(l.res - 1, (int)(v2 * l.res));
+    vertices.clear();
+    indices.clear();
+    for(int r=r1; r<=r2; r++)
+    {
+        auto first = l.x.begin() + l.row_start[r], last = l.x.begin() + l.row_start[r+1];
+        for(auto it = std::lower_bound(first, last, (float)u1); it!=last && *it<=u2; it++)
+        {
+            size_t i = it - l.x.begin();
+            double d = limit_mag - l.mag[i];
+            double alpha = d >= 0? 255 : 255 * std::pow(10.0, 0.4*d);
+            if(alpha < MIN_ALPHA || l.y[i] < v1 || l.y[i] > v2)
+                continue;
+            float s = d > 0? std::min(MAX_POINT_SIZE, 1 + 0.5*d) / 2 : 0.5;
+            float px = x + l.x[i]*w, py = y + l.y[i]*w;
+            SDL_Color c{(uint8_t)(l.color[i] >> 16), (uint8_t)(l.color[i] >> 8), (uint8_t)l.color[i], (uint8_t)alpha};
+            int v = vertices.size();
+            vertices.push_back(SDL_Vertex{SDL_FPoint{px - s, py - s}, c, SDL_FPoint{0, 0}});
+            vertices.push_back(SDL_Vertex{SDL_FPoint{px + s, py - s}, c, SDL_FPoint{0, 0}});
+            vertices.push_back(SDL_Vertex{SDL_FPoint{px + s, py + s}, c, SDL_FPoint{0, 0}});
+            vertices.push_back(SDL_Vertex{SDL_FPoint{px - s, py + s}, c, SDL_FPoint{0, 0}});
+            for(int j: {0, 1, 2, 0, 2, 3})
+                indices.push_back(v + j);
+        }
+    }
+    if(!vertices.empty())
+    {
+        renderGeometry(NULL, vertices.data(), vertices.size(), indices.data(), indices.size());
+    }
+}
+/**
+Returns the approximate color (0xRRGGBB) of a star with a given B-V color index
+*/
+uint32_t starColor(double bv)
+{
+    static const double BV[] = {-0.4, 0.0, 0.4, 0.6, 0.8, 1.2, 1.6, 2.0};
+    static const uint8_t RGB[][3] = {{155, 176, 255}, {202, 215, 255}, {248, 247, 255}, {255, 244, 234},
+                                     {255, 229, 207}, {255, 210, 161}, {255, 190, 111}, {255, 160, 80}};
+    const int N = sizeof(BV) / sizeof(BV[0]);
+    bv = std::max(BV[0], std::min(BV[N-1], bv));
+    int i = 0;
+    while(i < N-2 && bv > BV[i+1])
+        i++;
+    double t = (bv - BV[i]) / (BV[i+1] - BV[i]);
+    uint32_t res = 0;
+    for(int j=0; j<3; j++)
+        res = res << 8 | (uint32_t)std::lround(RGB[i][j] + (RGB[i+1][j] - RGB[i][j]) * t);
+    return res;
+}
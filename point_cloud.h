@@ -0,0 +1,59 @@
+/*Point clouds with merged levels of detail, for star fields
+*/
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <string>
+#include "sdl_base.h"
+/**
+A set of points (stars) with a position, magnitude and color each, stored as arrays. Level 0 holds every point, and each level after
+it merges the points in each cell of a grid half as fine as the last into a single point carrying their combined brightness, so a
+distant cloud is drawn with roughly one point per pixel no matter how many points it has.
+*/
+struct PointCloud
+{
+    static constexpr double LOD_CELL_PIXELS = 2; //the coarsest level whose cells are at most this many pixels across is drawn
+    static constexpr double MIN_ALPHA = 4; //fainter points aren't drawn at all
+    static constexpr double MAX_POINT_SIZE = 5;
+    static constexpr size_t CATALOG_CHUNK_SIZE = 1 << 22; //bytes of a catalog handed to each parsing thread at a time
+    struct Level
+    {
+        int res; //grid cells per side
+        std::vector<float> x, y; //from 0 to 1 across the cloud
+        std::vector<float> mag;
+        std::vector<uint32_t> color; //0xRRGGBB
+        std::vector<int> row_start; //points in grid row r are [row_start[r], row_start[r+1]), sorted by x
+    };
+    double limit_mag; //points at least this bright are drawn fully opaque, and brighter ones are drawn larger
+    std::vector<Level> levels;
+    PointCloud();
+    /**
+    Adds a point, with x and y from 0 to 1 across the cloud. build() has to be called once all points are added.
+    */
+    void addPoint(float x, float y, float mag, uint32_t color);
+    /**
+    Adds count randomly placed stars in a two armed spiral, and builds the cloud
+    */
+    void generate(int count, unsigned seed);
+    /**
+    Loads a CSV catalog and builds the cloud. The header names the columns, x and y are required, mag gives magnitudes (otherwise a
+    size column makes larger objects brighter), and bv gives B-V color indices. Sets (x, y, w) to the square the catalog covers in
+    its own units, returns false if the catalog can't be read.
+    */
+    bool loadCatalog(const std::string &file_name, double &x, double &y, double &w);
+    /**
+    Sorts the points and builds the merged levels
+    */
+    void build();
+    /**
+    Draws the cloud at (x, y) with size w by w, clipped to a view_w by view_h target
+    */
+    void render(double x, double y, double w, int view_w, int view_h);
+private:
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+};
+/**
+Returns the approximate color (0xRRGGBB) of a star with a given B-V color index
+*/
+uint32_t starColor(double bv);
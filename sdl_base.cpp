@@ -1,5 +1,9 @@
 //A simple SDL2 wrapper by Kevin Liu
 #include "sdl_base.h"
+#include "trace.h"
+#include "alloc_stats.h"
+#include "logger.h"
+#include "assets.h"
 #include <sstream>
 #include <cstdint>
 #include <cstdlib>
@@ -8,7 +12,6 @@
 #include <vector>
 #include <fstream>
 #include <map>
-#include <queue>
 #include <utility>
 #include <chrono>
 #include <cstdio>
@@ -17,18 +20,57 @@
 #include <algorithm>
 #include <random>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <tuple>
 #include <iostream> //for debugging
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_mixer.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shm_frames.h"
+#endif
 static const int SDL_BASE_NOT_SET = ((int)(1e9 + 23001));
 static SDL_Renderer *renderer = NULL;
 static SDL_Window *window = NULL;
 SDL_Event input;
 static const int NUM_FONT_SIZES = 8; //I assume no text with a size of more than 1,000 will be drawn
-static TTF_Font *font[NUM_FONT_SIZES];
+static TTF_Font *font[NUM_FONT_SIZES]; //opened on first use by getFontAt
+static bool fontOpened[NUM_FONT_SIZES];
+static std::mutex fontMutex;
+static std::atomic<bool> audioReady(false);
 static int prevTick = 0, frameLength;
+//for getRenderStats
+static RenderStats stats;
+static int drawCalls = 0;
+static long long lastPresentNs = -1;
 static int mouse_x, mouse_y;
+//dynamic resolution: the scene is drawn into the top left renderScale part of scaledTarget and stretched onto the window
+static const double MIN_RENDER_SCALE = 0.25;
+static SDL_Texture *scaledTarget = NULL;
+static int scaledTargetW, scaledTargetH;
+static bool scaledRenderActive = false;
+static double renderScale = 1, avgScaledFrameMs = 0;
+static long long scaledFrameStart = -1;
+//fillRect, drawRect, drawLine and drawPoint are queued and drawn together by flushPrimitives(), one SDL call per run of the same
+//kind and color. Horizontal and vertical lines are queued as filled rectangles. drawTextChars queues GLYPHS, whose color is in
+//their vertices, so they're only split up by a change of font size.
+enum PrimitiveKind {NO_PRIMITIVE, FILLED_RECTS, RECT_OUTLINES, LINES, POINTS, GLYPHS};
+static PrimitiveKind pendingKind = NO_PRIMITIVE;
+static SDL_Color drawColor{0, 0, 0, 255}, pendingColor;
+static std::vector<SDL_Rect> pendingRects;
+static std::vector<SDL_Point> pendingPoints;
+static std::vector<int> pendingLineStarts; //where each connected run of lines starts in pendingPoints
+static std::vector<SDL_Vertex> pendingVertices;
+static std::vector<int> pendingIndices;
+static SDL_Texture *pendingTexture = NULL;
+//the printable ASCII characters side by side in white, one texture per font size, for drawTextChars
+static const char FIRST_GLYPH = ' ', LAST_GLYPH = '~';
+static const int NUM_GLYPHS = LAST_GLYPH - FIRST_GLYPH + 1;
+static SDL_Texture *glyphAtlas[NUM_FONT_SIZES]; //created on first use, and lost with the renderer like text_textures
 //a text SDL_Texture cache greatly speeds up stuff because we don't have to create the SDL_Texture every time
 struct text_info
 {
@@ -36,9 +78,60 @@ struct text_info
     uint8_t r, g, b;
     int sz;
     text_info(std::string ss, int size, uint8_t r1, uint8_t g1, uint8_t b1);
-    bool operator<(text_info x) const;
 };
-static std::map<text_info, std::pair<int, SDL_Texture*> > text_textures; //text_info, <time last used, SDL_Texture>
+//what drawText looks up in the cache, so it can search with a string_view without building a std::string
+struct text_key
+{
+    std::string_view s;
+    int sz;
+    uint8_t r, g, b;
+};
+static std::tuple<std::string_view, int, uint8_t, uint8_t, uint8_t> textKey(const text_info &t)
+{
+    return std::make_tuple(std::string_view(t.s), t.sz, t.r, t.g, t.b);
+}
+static std::tuple<std::string_view, int, uint8_t, uint8_t, uint8_t> textKey(const text_key &t)
+{
+    return std::make_tuple(t.s, t.sz, t.r, t.g, t.b);
+}
+struct text_less
+{
+    using is_transparent = void;
+    template<class A, class B> bool operator()(const A &a, const B &b) const
+    {
+        return textKey(a) < textKey(b);
+    }
+};
+static std::map<text_info, std::pair<int, SDL_Texture*>, text_less> text_textures; //text_info, <time last used, SDL_Texture>
+//FIFO of ints that only reallocates when it's full, unlike std::queue, which allocates and frees blocks as it moves along
+struct TimestampRing
+{
+    std::vector<int> v = std::vector<int>(64);
+    size_t head = 0, n = 0;
+    void push(int x)
+    {
+        if(n == v.size())
+        {
+            std::rotate(v.begin(), v.begin() + head, v.end());
+            head = 0;
+            v.resize(v.size() * 2);
+        }
+        v[(head + n++) % v.size()] = x;
+    }
+    int front() const
+    {
+        return v[head];
+    }
+    void pop()
+    {
+        head = (head + 1) % v.size();
+        n--;
+    }
+    size_t size() const
+    {
+        return n;
+    }
+};
 namespace sdl_settings
 {
     bool lowTextureQuality = true;
@@ -56,7 +149,13 @@ namespace sdl_settings
     int FPS_CAP = 300; //FPS cap (300 is essentially uncapped)
     int TEXT_TEXTURE_CACHE_TIME = 1100; //number of milliseconds of being unused after a which a text SDL_Texture is destroyed
     double textSizeMult = 1;
-    static std::queue<int> frameTimeStamp;
+    bool dynamicResolution = false;
+    double frameTimeBudget = 20;
+    bool captureRaw = false;
+    bool backgroundInit = true;
+    bool trace = false;
+    int logLevel = LOG_INFO;
+    static TimestampRing frameTimeStamp;
     //code for reading config
     static const char *const FOUT_FILE_NAME = "sdl_base_config.txt";
     static bool init = false;
@@ -79,12 +178,18 @@ namespace sdl_settings
         vals["FONT_QUALITY"] = std::make_pair("int", &fontQuality);
         vals["RENDER_SCALE_QUALITY"] = std::make_pair("int", &renderScaleQuality);
         vals["TEXT_TEXTURE_CACHE_TIME"] = std::make_pair("int", &TEXT_TEXTURE_CACHE_TIME);
+        vals["TRACE"] = std::make_pair("bool", &trace);
+        vals["LOG_LEVEL"] = std::make_pair("int", &logLevel);
         vals["TEXT_BLENDED"] = std::make_pair("bool", &textBlended);
         vals["R_GAMMA"] = std::make_pair("double", &Rgamma);
         vals["G_GAMMA"] = std::make_pair("double", &Ggamma);
         vals["B_GAMMA"] = std::make_pair("double", &Bgamma);
         vals["BRIGHTNESS"] = std::make_pair("double", &brightness);
         vals["TEXT_SIZE"] = std::make_pair("double", &textSizeMult);
+        vals["BACKGROUND_INIT"] = std::make_pair("bool", &backgroundInit);
+        vals["CAPTURE_RAW"] = std::make_pair("bool", &captureRaw);
+        vals["DYNAMIC_RESOLUTION"] = std::make_pair("bool", &dynamicResolution);
+        vals["FRAME_TIME_BUDGET"] = std::make_pair("double", &frameTimeBudget);
     }
     void output_config()
     {
@@ -124,10 +229,14 @@ namespace sdl_settings
     {
         if(!init)
             init_config();
-        std::ifstream fin(FOUT_FILE_NAME);
+        //output_config saves to the file on disk, so it takes precedence over an embedded copy, which only provides defaults
+        std::unique_ptr<std::istream> in = std::make_unique<std::ifstream>(FOUT_FILE_NAME);
+        if(in->fail())
+            in = openAsset(FOUT_FILE_NAME);
+        std::istream &fin = *in;
         if(fin.fail())
         {
-            println("Failed to load config file. Using default values.");
+            logWarning("Failed to load config file. Using default values.");
         }
         else
         {
@@ -139,7 +248,7 @@ namespace sdl_settings
                     break;
                 if(!vals.count(s1))
                 {
-                    println("Cannot find setting name " + (std::string)"\"" + s1 + "\"");
+                    logWarning("Cannot find setting name \"%s\"", s1);
                 }
                 else
                 {
@@ -152,29 +261,22 @@ namespace sdl_settings
                 }
             }
         }
-        fin.close();
     }
 }
 //Non SDL functions
 /**
-This prints a string to stdout
+This prints a string to stdout, through the logger at LOG_INFO
 */
 void print(std::string s)
 {
-    //stdoutMutex.lock();
-    std::puts(("[" + seconds_to_str(getTicksS()) + "]" + s).c_str());
-    std::fflush(stdout);
-    //stdoutMutex.unlock();
+    logInfo("%s", s);
 }
 /**
-This prints a string and appends a newline to stdout
+This prints a string and appends a newline to stdout, through the logger at LOG_INFO
 */
 void println(std::string s)
 {
-    //stdoutMutex.lock();
-    std::puts(("[" + seconds_to_str(getTicksS()) + "]" + s).c_str());
-    std::fflush(stdout);
-    //stdoutMutex.unlock();
+    logInfo("%s", s);
 }
 /**
 Converts something to a string
@@ -354,10 +456,14 @@ Initializes a window and renderer.
 static void createWindow(const char *name)
 {
     using namespace sdl_settings;
-    if(window)
-        SDL_DestroyWindow(window);
+    //the renderer goes first, while its window still exists, and anything queued for it is drawn before it goes
     if(renderer)
+    {
+        flushPrimitives();
         SDL_DestroyRenderer(renderer);
+    }
+    if(window)
+        SDL_DestroyWindow(window);
     window = SDL_CreateWindow(name, WINDOW_X, WINDOW_Y, WINDOW_W, WINDOW_H,
                                     SDL_WINDOW_SHOWN | (SDL_WINDOW_FULLSCREEN*(int)IS_FULLSCREEN) | SDL_WINDOW_RESIZABLE);
     renderer = SDL_CreateRenderer(window, -1, (SDL_RENDERER_ACCELERATED*acceleratedRenderer) | (SDL_RENDERER_PRESENTVSYNC*vsync));
@@ -408,39 +514,116 @@ void resetGamma()
     setGamma(Rgamma, Ggamma, Bgamma);
 }
 /**
-Initializes SDL with a given window name
+Initializes the image decoders the first time it's called
 */
-void initSDL(const char *name)
+static void initImageLoading()
 {
-    bool alreadyInit = false;
-    using namespace sdl_settings;
-    if(!alreadyInit)
+    static std::once_flag done;
+    std::call_once(done, []
     {
-        alreadyInit = true;
-        srand(time(NULL));
-        if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
-            println((std::string)"SDL_GetError(): " + SDL_GetError());
+        if(IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) < 0)
+            logError("IMG_GetError(): %s", IMG_GetError());
+    });
+}
+/**
+Equivalent to IMG_Load, but initializes the image decoders first if needed and reads embedded files in place
+*/
+static SDL_Surface *loadImage(const char *name)
+{
+    TRACE_SCOPE("decodeImage");
+    initImageLoading();
+    SDL_RWops *rw = openEmbeddedRW(name);
+    return rw != NULL? IMG_Load_RW(rw, 1) : IMG_Load(name);
+}
+/**
+Returns the font of size 2^pos, opening it the first time it's needed
+*/
+static TTF_Font *getFontAt(int pos)
+{
+    std::lock_guard<std::mutex> lock(fontMutex);
+    if(!fontOpened[pos])
+    {
+        fontOpened[pos] = true;
+        SDL_RWops *rw = openEmbeddedRW("font.ttf");
+        font[pos] = rw != NULL? TTF_OpenFontRW(rw, 1, 1 << pos) : TTF_OpenFont("font.ttf", 1 << pos);
+        if(font[pos] == NULL)
+            logError("TTF_GetError(): %s", TTF_GetError());
+        else if(pos == 0 && !TTF_FontFaceIsFixedWidth(font[pos]))
+            logWarning("font may not be monospaced, which may cause rendering issues");
+    }
+    return font[pos];
+}
+/**
+Opens the audio device and mixer the first time it's called
+*/
+static void initAudio()
+{
+    static std::once_flag done;
+    std::call_once(done, []
+    {
+        using namespace sdl_settings;
+        if(SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+            logError("SDL_GetError(): %s", SDL_GetError());
         if(Mix_Init(MIX_INIT_MP3 | MIX_INIT_FLAC))
-            println((std::string)"Mix_GetError(): " + Mix_GetError());
+            logError("Mix_GetError(): %s", Mix_GetError());
         if(Mix_OpenAudio(22050, MIX_DEFAULT_FORMAT, 2, 4096) < 0)
-            println((std::string)"Mix_GetError(): " + Mix_GetError());
+            logError("Mix_GetError(): %s", Mix_GetError());
         Mix_Volume(-1, sfxVolume);
         Mix_VolumeMusic(musicVolume);
         Mix_AllocateChannels(32);
+        audioReady = true;
+    });
+}
+static std::thread initThread; //warms up image loading and fonts in the background, joined by quitSDL
+//registered with atexit by initSDL, so SDL isn't shut down while initThread is still using it
+static void quitSDL()
+{
+    if(initThread.joinable())
+        initThread.join();
+    SDL_Quit();
+}
+/**
+Initializes SDL with a given window name. The first call also registers SDL's shutdown with atexit.
+*/
+void initSDL(const char *name)
+{
+    static bool alreadyInit = false;
+    using namespace sdl_settings;
+    if(!alreadyInit)
+    {
+        alreadyInit = true;
+        srand(time(NULL));
+        //audio, image decoders and fonts are set up when they're first used, so the window appears as soon as possible
+        if(SDL_Init(SDL_INIT_VIDEO) < 0)
+            logError("SDL_GetError(): %s", SDL_GetError());
         if(TTF_Init() < 0)
-            println((std::string)"TTF_GetError(): " + TTF_GetError());
-        if(IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) < 0)
-            println((std::string)"IMG_GetError(): " + IMG_GetError());
-        for(int i=0, v=1; i<NUM_FONT_SIZES; i++, v*=2)
-            font[i] = TTF_OpenFont("font.ttf", v);
-        if(font[0] == NULL)
-            println((std::string)"TTF_GetError(): " + TTF_GetError());
-        else if(!TTF_FontFaceIsFixedWidth(font[0]))
-            println("Warning: font may not be monospaced, which may cause rendering issues");
+            logError("TTF_GetError(): %s", TTF_GetError());
         getTicks();
+        if(trace)
+        {
+            traceThreadName("main");
+            atexit([]{writeTrace("trace.json");});
+        }
+        atexit(quitSDL);
+        createWindow(name);
+        if(backgroundInit)
+        {
+            initThread = std::thread([]
+            {
+                initImageLoading();
+                for(int i=0; i<NUM_FONT_SIZES; i++)
+                    getFontAt(i);
+            });
+        }
+    }
+    else
+    {
+        text_textures.clear();
+        for(auto &t: glyphAtlas)
+            t = NULL;
+        stats.text_cache_bytes = 0;
+        createWindow(name);
     }
-    else text_textures.clear();
-    createWindow(name);
     //let's not mess with gammas and brightness
     /*if(brightness == -1) //not yet set
     {
@@ -464,20 +647,96 @@ void reinitSDL()
 {
     createWindow(SDL_GetWindowTitle(window));
     text_textures.clear();
+    for(auto &t: glyphAtlas)
+        t = NULL;
+    stats.text_cache_bytes = 0;
 }
 /**
-Equivalent to SDL_SetRenderDrawColor
+Sets the color used by renderClear and the primitive drawing functions
 */
 void setColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
-    SDL_SetRenderDrawColor(renderer, r, g, b, a);
+    drawColor = SDL_Color{r, g, b, a};
+}
+/**
+Draws all queued primitives. This happens automatically before anything else is drawn or the target changes, so it only has to be
+called before using the renderer directly.
+*/
+void flushPrimitives()
+{
+    if(pendingKind == NO_PRIMITIVE)
+        return;
+    PrimitiveKind kind = pendingKind;
+    pendingKind = NO_PRIMITIVE; //renderGeometry flushes first too
+    SDL_SetRenderDrawColor(renderer, pendingColor.r, pendingColor.g, pendingColor.b, pendingColor.a);
+    switch(kind)
+    {
+    case FILLED_RECTS:
+        SDL_RenderFillRects(renderer, pendingRects.data(), pendingRects.size());
+        drawCalls++;
+        break;
+    case RECT_OUTLINES:
+        SDL_RenderDrawRects(renderer, pendingRects.data(), pendingRects.size());
+        drawCalls++;
+        break;
+    case LINES:
+        pendingLineStarts.push_back(pendingPoints.size());
+        for(size_t i=0; i+1<pendingLineStarts.size(); i++)
+        {
+            SDL_RenderDrawLines(renderer, &pendingPoints[pendingLineStarts[i]], pendingLineStarts[i+1] - pendingLineStarts[i]);
+            drawCalls++;
+        }
+        break;
+    case POINTS:
+        SDL_RenderDrawPoints(renderer, pendingPoints.data(), pendingPoints.size());
+        drawCalls++;
+        break;
+    case GLYPHS:
+        renderGeometry(pendingTexture, pendingVertices.data(), pendingVertices.size(), pendingIndices.data(), pendingIndices.size());
+        break;
+    default:
+        break;
+    }
+    pendingRects.clear();
+    pendingPoints.clear();
+    pendingLineStarts.clear();
+    pendingVertices.clear();
+    pendingIndices.clear();
+}
+/**
+Flushes the queue if it holds a different kind of primitive or color
+*/
+static void queuePrimitive(PrimitiveKind k)
+{
+    const SDL_Color &c = drawColor, &p = pendingColor;
+    if(k != pendingKind || c.r != p.r || c.g != p.g || c.b != p.b || c.a != p.a)
+    {
+        flushPrimitives();
+        pendingKind = k;
+        pendingColor = drawColor;
+    }
+}
+/**
+Flushes the queue unless it holds glyphs from the same texture
+*/
+static void queueGlyphs(SDL_Texture *t)
+{
+    if(pendingKind != GLYPHS || pendingTexture != t)
+    {
+        flushPrimitives();
+        pendingKind = GLYPHS;
+        pendingTexture = t;
+    }
 }
 /**
 Equivalent to SDL_RenderClear
 */
 void renderClear()
 {
+    flushPrimitives();
+    SDL_SetRenderDrawColor(renderer, drawColor.r, drawColor.g, drawColor.b, drawColor.a);
     SDL_RenderClear(renderer);
+    drawCalls++;
 }
 /**
 Equivalent to SDL_RenderClear
@@ -485,21 +744,25 @@ Equivalent to SDL_RenderClear
 void renderClear(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
     setColor(r, g, b, a);
-    SDL_RenderClear(renderer);
+    renderClear();
 }
 /**
 Equivalent to SDL_RenderCopy
 */
 void renderCopy(SDL_Texture *t, SDL_Rect *dst)
 {
+    flushPrimitives();
     SDL_RenderCopy(renderer, t, NULL, dst);
+    drawCalls++;
 }
 /**
 Equivalent to SDL_RenderCopy
 */
 void renderCopy(SDL_Texture *t, SDL_Rect *src, SDL_Rect *dst)
 {
+    flushPrimitives();
     SDL_RenderCopy(renderer, t, src, dst);
+    drawCalls++;
 }
 /**
 Equivalent to SDL_RenderCopy
@@ -510,12 +773,52 @@ void renderCopy(SDL_Texture *t, int x, int y, int w, int h)
     renderCopy(t, &r);
 }
 /**
+Draws src (or the whole texture if it's NULL) into the rectangle (x, y, w, h) of a view_w by view_h target, cropping it to the target
+in double precision first, so even hugely magnified textures are drawn exactly and only the visible texels are rasterized
+*/
+void renderCopyF(SDL_Texture *t, SDL_Rect *src, double x, double y, double w, double h, int view_w, int view_h)
+{
+    SDL_Rect full{0, 0, 0, 0};
+    if(src == NULL)
+    {
+        if(SDL_QueryTexture(t, NULL, NULL, &full.w, &full.h) != 0)
+            return;
+        src = &full;
+    }
+    if(w <= 0 || h <= 0 || src->w <= 0 || src->h <= 0)
+        return;
+    double sx = w / src->w, sy = h / src->h; //target pixels per texel
+    double u1 = std::max(0.0, -x / sx), v1 = std::max(0.0, -y / sy);
+    double u2 = std::min((double)src->w, (view_w - x) / sx), v2 = std::min((double)src->h, (view_h - y) / sy);
+    if(u1 >= u2 || v1 >= v2)
+        return;
+    //whole texels, plus one more on each side so filtering at the visible edges still blends with the texels beyond them
+    int i1 = std::max(0, (int)std::floor(u1) - 1), j1 = std::max(0, (int)std::floor(v1) - 1);
+    int i2 = std::min(src->w, (int)std::ceil(u2) + 1), j2 = std::min(src->h, (int)std::ceil(v2) + 1);
+    SDL_Rect s{src->x + i1, src->y + j1, i2 - i1, j2 - j1};
+    SDL_FRect d{(float)(x + i1 * sx), (float)(y + j1 * sy), (float)((i2 - i1) * sx), (float)((j2 - j1) * sy)};
+    flushPrimitives();
+    SDL_RenderCopyF(renderer, t, &s, &d);
+    drawCalls++;
+}
+/**
 Equivalent to SDL_RenderCopyEx
 */
 void renderCopyEx(SDL_Texture *t, int x, int y, int w, int h, double rot, SDL_Point *center, SDL_RendererFlip f)
 {
     SDL_Rect r{x, y, w, h};
+    flushPrimitives();
     SDL_RenderCopyEx(renderer, t, NULL, &r, rot, center, f);
+    drawCalls++;
+}
+/**
+Equivalent to SDL_RenderGeometry
+*/
+void renderGeometry(SDL_Texture *t, const SDL_Vertex *vertices, int num_vertices, const int *indices, int num_indices)
+{
+    flushPrimitives();
+    SDL_RenderGeometry(renderer, t, vertices, num_vertices, indices, num_indices);
+    drawCalls++;
 }
 /**
 Returns the position in font[NUM_FONT_SIZES] that should be used to render a text of a given size.
@@ -531,12 +834,13 @@ Converts a string into an SDL_Texture
 */
 SDL_Texture *createText(std::string txt, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a) //creates but doesn't render text
 {
+    TRACE_SCOPE("createText");
     using namespace sdl_settings;
     SDL_Color col{r, g, b, a};
     SDL_Surface *__s;
     if(textBlended)
-        __s = TTF_RenderText_Blended(font[getFontSizePos(s)], txt.c_str(), col);
-    else __s = TTF_RenderText_Solid(font[getFontSizePos(s)], txt.c_str(), col);
+        __s = TTF_RenderText_Blended(getFontAt(getFontSizePos(s)), txt.c_str(), col);
+    else __s = TTF_RenderText_Solid(getFontAt(getFontSizePos(s)), txt.c_str(), col);
     SDL_Texture *__t = SDL_CreateTextureFromSurface(renderer, __s);
     SDL_FreeSurface(__s);
     return __t;
@@ -549,238 +853,194 @@ text_info::text_info(std::string ss, int size, uint8_t r1, uint8_t g1, uint8_t b
     g = g1;
     b = b1;
 }
-bool text_info::operator<(text_info x) const
-{
-    if(s != x.s)
-        return s < x.s;
-    if(sz != x.sz)
-        return sz < x.sz;
-    if(r != x.r)
-        return r < x.r;
-    if(g != x.g)
-        return g < x.g;
-    if(b != x.b)
-        return b < x.b;
-    return 0;
-}
 /**
 Draws unwrapped text on the window. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME (1100ms by default).
 */
-void drawText(std::string text, int x, int y, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+void drawText(std::string_view text, int x, int y, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
-    text_info tInfo(text, getFontSizePos(s), r, g, b);
-    auto z = text_textures.find(tInfo); //check if this is in the cache first
+    text_key key{text, getFontSizePos(s), r, g, b};
+    auto z = text_textures.find(key); //check if this is in the cache first
     SDL_Texture *__t;
     if(z != text_textures.end())
     {
         z->second.first = getTicks();
         __t = z->second.second;
+        stats.text_hits++;
     }
     else
     {
-        __t = createText(text, s, r, g, b);
-        text_textures[tInfo] = std::make_pair(getTicks(), __t);
+        __t = createText(std::string(text), s, r, g, b);
+        stats.text_misses++;
+        stats.text_cache_bytes += getTextureBytes(__t);
+        text_textures[text_info(std::string(text), key.sz, r, g, b)] = std::make_pair(getTicks(), __t);
     }
     SDL_Rect dst{x, y, (int)(text.size() * s/2), s};
     SDL_SetTextureAlphaMod(__t, a);
     renderCopy(__t, &dst);
 }
 /**
-Draws wrapped text on the window, and breaks won't occur in the middle of words. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME.
+Draws text one character at a time from a cached texture of every printable ASCII character, so text that changes every frame
+(like numbers) doesn't create a new texture every frame. The characters are queued like primitives and drawn together with one
+SDL_RenderGeometry call, even across calls with different colors. Characters outside printable ASCII are left out.
 */
-int drawMultilineTextUnbroken(std::string text, int x, int y, int w, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+void drawTextChars(std::string_view text, int x, int y, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
-    size_t maxLength = 2*w / s;
-    int lines = 0;
-    while(text.size())
+    int pos = getFontSizePos(s);
+    if(glyphAtlas[pos] == NULL)
     {
-        std::string cur;
-        for(size_t i=0; i<std::min(maxLength, text.size()); i++)
-        {
-            if(text[i] == '\n')
-            {
-                cur = text.substr(0, i);
-                text.erase(0, i+1);
-                break;
-            }
-        }
-        if(cur.size() == 0)
-        {
-            if(text.size() <= maxLength)
-            {
-                cur = text;
-                text.clear();
-            }
-            else
-            {
-                int l = maxLength;
-                while(text[l] != ' ')
-                    l--;
-                cur = text.substr(0, l);
-                text.erase(0, l+1);
-            }
-        }
-        drawText(cur, x, y, s, r, g, b, a);
-        y += s;
-        lines++;
+        std::string glyphs;
+        for(char c=FIRST_GLYPH; c<=LAST_GLYPH; c++)
+            glyphs += c;
+        glyphAtlas[pos] = createText(glyphs, s, 255, 255, 255);
+        if(glyphAtlas[pos] == NULL)
+            return;
+        stats.text_cache_bytes += getTextureBytes(glyphAtlas[pos]);
+    }
+    //the font is monospaced, so each character takes up the same share of the texture
+    queueGlyphs(glyphAtlas[pos]);
+    SDL_Color c{r, g, b, a};
+    for(size_t i=0; i<text.size(); i++)
+    {
+        if(text[i] <= FIRST_GLYPH || text[i] > LAST_GLYPH)
+            continue;
+        float x1 = x + (int)i*s/2, x2 = x1 + s/2, u1 = (float)(text[i] - FIRST_GLYPH) / NUM_GLYPHS, u2 = u1 + 1.0f / NUM_GLYPHS;
+        int n = pendingVertices.size();
+        pendingVertices.push_back(SDL_Vertex{SDL_FPoint{x1, (float)y}, c, SDL_FPoint{u1, 0}});
+        pendingVertices.push_back(SDL_Vertex{SDL_FPoint{x2, (float)y}, c, SDL_FPoint{u2, 0}});
+        pendingVertices.push_back(SDL_Vertex{SDL_FPoint{x1, (float)(y + s)}, c, SDL_FPoint{u1, 1}});
+        pendingVertices.push_back(SDL_Vertex{SDL_FPoint{x2, (float)(y + s)}, c, SDL_FPoint{u2, 1}});
+        for(int k: {0, 1, 2, 2, 1, 3})
+            pendingIndices.push_back(n + k);
     }
-    return lines;
 }
 /**
-Fills in xpos and ypos with the x and y position of the last character drawn from the drawMultilineTextUnbroken function.
+Breaks text into lines of at most maxLength characters, starting new lines at newlines. If unbroken is set, long lines are broken at
+the last space that fits instead of in the middle of words.
 */
-void getMultilineTextUnbrokenInfo(std::string text, int w, int s, std::vector<std::string> &ltext)
+static void breakLines(std::string_view text, size_t maxLength, bool unbroken, std::vector<TextLayout::Line> &lines)
 {
-    size_t maxLength = 2*w / s;
-    int lines = 0;
-    while(text.size())
+    maxLength = std::max<size_t>(1, maxLength);
+    size_t pos = 0;
+    while(pos < text.size())
     {
-        std::string cur;
-        for(size_t i=0; i<std::min(maxLength, text.size()); i++)
+        size_t len = std::min(maxLength, text.size() - pos), next;
+        size_t nl = text.substr(pos, len).find('\n');
+        if(nl != std::string_view::npos)
         {
-            if(text[i] == '\n')
-            {
-                cur = text.substr(0, i);
-                text.erase(0, i+1);
-                break;
-            }
+            len = nl;
+            next = pos + nl + 1;
         }
-        if(cur.size() == 0)
+        else if(pos + len == text.size())
+            next = pos + len;
+        else
         {
-            if(text.size() <= maxLength)
+            size_t space = unbroken? text.substr(pos, len + 1).rfind(' ') : std::string_view::npos;
+            if(space != std::string_view::npos && space > 0)
             {
-                cur = text;
-                text.clear();
-            }
-            else
-            {
-                int l = maxLength;
-                while(text[l] != ' ')
-                    l--;
-                cur = text.substr(0, l);
-                text.erase(0, l+1);
+                len = space;
+                next = pos + space + 1;
             }
+            else next = pos + len;
         }
-        ltext.push_back(cur);
-        /*if(xpos != NULL) //we could optimize this but whatever
-            *xpos = (int)cur.size();
-        if(ypos != NULL)
-            *ypos = lines;
-        if(xpos!=NULL && *xpos == (int)maxLength)
-        {
-            *xpos = 0;
-            if(ypos != NULL)
-                (*ypos)++;
-        }*/
-        lines++;
+        lines.push_back(TextLayout::Line{pos, len});
+        pos = next;
+    }
+}
+/**
+Lays out text wrapped to width w at size s, unless the layout already holds exactly that. If unbroken is set, breaks won't occur in the middle of words.
+*/
+void layoutText(TextLayout &layout, std::string_view text, int w, int s, bool unbroken)
+{
+    if(layout.w == w && layout.s == s && layout.unbroken == unbroken && layout.text == text)
+        return;
+    layout.text.assign(text.data(), text.size());
+    layout.w = w;
+    layout.s = s;
+    layout.unbroken = unbroken;
+    layout.lines.clear();
+    breakLines(layout.text, 2*w / std::max(1, s), unbroken, layout.lines);
+}
+/**
+Draws text laid out by layoutText, returns the number of lines
+*/
+int drawTextLayout(const TextLayout &layout, int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    std::string_view text = layout.text;
+    for(auto &l: layout.lines)
+    {
+        drawText(text.substr(l.start, l.length), x, y, layout.s, r, g, b, a);
+        y += layout.s;
     }
+    return layout.lines.size();
+}
+/**
+Draws wrapped text on the window, and breaks won't occur in the middle of words. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME.
+*/
+int drawMultilineTextUnbroken(std::string_view text, int x, int y, int w, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    static std::vector<TextLayout::Line> lines; //reused so drawing doesn't allocate
+    lines.clear();
+    breakLines(text, 2*w / std::max(1, s), true, lines);
+    for(auto &l: lines)
+    {
+        drawText(text.substr(l.start, l.length), x, y, s, r, g, b, a);
+        y += s;
+    }
+    return lines.size();
+}
+/**
+Fills in xpos and ypos with the x and y position of the last character drawn from the drawMultilineTextUnbroken function.
+*/
+void getMultilineTextUnbrokenInfo(std::string_view text, int w, int s, std::vector<std::string> &ltext)
+{
+    std::vector<TextLayout::Line> lines;
+    breakLines(text, 2*w / std::max(1, s), true, lines);
+    for(auto &l: lines)
+        ltext.emplace_back(text.substr(l.start, l.length));
 }
 /**
 Draws wrapped text on the window. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME.
 */
-int drawMultilineText(std::string text, int x, int y, int w, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+int drawMultilineText(std::string_view text, int x, int y, int w, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
-    size_t maxLength = 2*w / s;
-    int lines = 0;
-    while(text.size())
+    static std::vector<TextLayout::Line> lines; //reused so drawing doesn't allocate
+    lines.clear();
+    breakLines(text, 2*w / std::max(1, s), false, lines);
+    for(auto &l: lines)
     {
-        std::string cur;
-        for(size_t i=0; i<std::min(maxLength, text.size()); i++)
-        {
-            if(text[i] == '\n')
-            {
-                cur = text.substr(0, i);
-                text.erase(0, i+1);
-                break;
-            }
-        }
-        if(cur.size() == 0)
-        {
-            if(text.size() <= maxLength)
-            {
-                cur = text;
-                text.clear();
-            }
-            else
-            {
-                cur = text.substr(0, maxLength);
-                text.erase(0, maxLength);
-            }
-        }
-        drawText(cur, x, y, s, r, g, b, a);
+        drawText(text.substr(l.start, l.length), x, y, s, r, g, b, a);
         y += s;
-        lines++;
     }
-    return lines;
+    return lines.size();
 }
 /**
 Fills in xpos and ypos with the x and y position of the last character drawn from the drawMultilineText function.
 */
-void getMultilineTextPos(std::string text, int w, int s, int *xpos, int *ypos)
-{
-    size_t maxLength = 2*w / s;
-    int lines = 0;
-    while(text.size())
+void getMultilineTextPos(std::string_view text, int w, int s, int *xpos, int *ypos)
+{
+    size_t maxLength = std::max(1, 2*w / std::max(1, s));
+    std::vector<TextLayout::Line> lines;
+    breakLines(text, maxLength, false, lines);
+    if(lines.empty())
+        return;
+    if(xpos != NULL) //also note the wrapping
+        *xpos = (int)lines.back().length;
+    if(ypos != NULL)
+        *ypos = lines.size() - 1;
+    if(xpos!=NULL && *xpos == (int)maxLength)
     {
-        std::string cur;
-        for(size_t i=0; i<std::min(maxLength, text.size()); i++)
-        {
-            if(text[i] == '\n')
-            {
-                cur = text.substr(0, i);
-                text.erase(0, i+1);
-                break;
-            }
-        }
-        if(cur.size() == 0)
-        {
-            if(text.size() <= maxLength)
-            {
-                cur = text;
-                text.clear();
-            }
-            else
-            {
-                cur = text.substr(0, maxLength);
-                text.erase(0, maxLength);
-            }
-        }
-        if(xpos != NULL) //we could optimize this but whatever, also note the wrapping
-            *xpos = (int)cur.size();
+        *xpos = 0;
         if(ypos != NULL)
-            *ypos = lines;
-        if(xpos!=NULL && *xpos == (int)maxLength)
-        {
-            *xpos = 0;
-            if(ypos != NULL)
-                (*ypos)++;
-        }
-        lines++;
+            (*ypos)++;
     }
 }
 /**
 Returns how many times a given text will be wrapped if it is drawn
 */
-int multilineTextLength(std::string text, int w, int s)
+int multilineTextLength(std::string_view text, int w, int s)
 {
-    size_t maxLength = 2*w / s;
-    int lines = 0;
-    while(text.size())
-    {
-        std::string cur;
-        if(text.size() <= maxLength)
-        {
-            cur = text;
-            text.clear();
-        }
-        else
-        {
-            cur = text.substr(0, maxLength);
-            text.erase(0, maxLength);
-        }
-        lines++;
-    }
-    return lines;
+    size_t maxLength = std::max(1, 2*w / std::max(1, s));
+    return (text.size() + maxLength - 1) / maxLength;
 }
 /**
 Displays a loading screen
@@ -790,6 +1050,7 @@ void showLoadingScreen()
     using namespace sdl_settings;
     renderClear(0, 0, 0);
     drawText("Loading...", 0, 0, WINDOW_H/20, 255, 255, 255);
+    flushPrimitives();
     SDL_RenderPresent(renderer);
 }
 /**
@@ -797,7 +1058,15 @@ Equivalent to SDL_RenderFillRect
 */
 void fillRect(SDL_Rect *x)
 {
-    SDL_RenderFillRect(renderer, x);
+    if(x == NULL)
+    {
+        SDL_Rect v;
+        SDL_RenderGetViewport(renderer, &v);
+        fillRect(0, 0, v.w, v.h);
+        return;
+    }
+    queuePrimitive(FILLED_RECTS);
+    pendingRects.push_back(*x);
 }
 /**
 Equivalent to SDL_RenderFillRect
@@ -805,16 +1074,15 @@ Equivalent to SDL_RenderFillRect
 void fillRect(SDL_Rect *x, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
     setColor(r, g, b, a);
-    SDL_RenderFillRect(renderer, x);
+    fillRect(x);
 }
 /**
 Equivalent to SDL_RenderFillRect
 */
 void fillRect(int x, int y, int w, int h)
 {
-    SDL_Rect *temp = new SDL_Rect{x, y, w, h};
-    SDL_RenderFillRect(renderer, temp);
-    delete temp;
+    queuePrimitive(FILLED_RECTS);
+    pendingRects.push_back(SDL_Rect{x, y, w, h});
 }
 /**
 Equivalent to SDL_RenderFillRect
@@ -829,7 +1097,15 @@ Equivalent to SDL_RenderDrawRect
 */
 void drawRect(SDL_Rect *x)
 {
-    SDL_RenderDrawRect(renderer, x);
+    if(x == NULL)
+    {
+        SDL_Rect v;
+        SDL_RenderGetViewport(renderer, &v);
+        drawRect(0, 0, v.w, v.h);
+        return;
+    }
+    queuePrimitive(RECT_OUTLINES);
+    pendingRects.push_back(*x);
 }
 /**
 Equivalent to SDL_RenderDrawRect
@@ -837,15 +1113,15 @@ Equivalent to SDL_RenderDrawRect
 void drawRect(SDL_Rect *x, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
     setColor(r, g, b, a);
-    SDL_RenderDrawRect(renderer, x);
+    drawRect(x);
 }
 /**
 Equivalent to SDL_RenderDrawRect
 */
 void drawRect(int x, int y, int w, int h)
 {
-    SDL_Rect temp{x, y, w, h};
-    SDL_RenderDrawRect(renderer, &temp);
+    queuePrimitive(RECT_OUTLINES);
+    pendingRects.push_back(SDL_Rect{x, y, w, h});
 }
 /**
 Equivalent to SDL_RenderDrawRect
@@ -870,14 +1146,59 @@ void setTextureAlphaMod(SDL_Texture *t, uint8_t a)
     SDL_SetTextureAlphaMod(t, a);
 }
 /**
+Gets an image file's size without decoding it, from the header of PNG and JPEG files. Other formats are decoded.
+Returns false on failure.
+*/
+bool getImageSize(const std::string &file_name, int &w, int &h)
+{
+    auto in = openAsset(file_name, std::ios::binary);
+    std::istream &fin = *in;
+    unsigned char b[24];
+    if(!fin.read((char*)b, 4))
+        return false;
+    if(b[0] == 0x89 && b[1] == 'P' && b[2] == 'N' && b[3] == 'G' && fin.read((char*)b + 4, 20)) //IHDR is always the first chunk
+    {
+        w = b[16]<<24 | b[17]<<16 | b[18]<<8 | b[19];
+        h = b[20]<<24 | b[21]<<16 | b[22]<<8 | b[23];
+        return true;
+    }
+    if(b[0] == 0xFF && b[1] == 0xD8)
+    {
+        //walk the segments up to the start of frame, which has the size; 0xC4, 0xC8 and 0xCC share its range but aren't frames
+        fin.seekg(2);
+        while(fin.read((char*)b, 4) && b[0] == 0xFF)
+        {
+            int length = b[2]<<8 | b[3];
+            if(b[1] >= 0xC0 && b[1] <= 0xCF && b[1] != 0xC4 && b[1] != 0xC8 && b[1] != 0xCC)
+            {
+                if(!fin.read((char*)b, 5))
+                    return false;
+                h = b[1]<<8 | b[2];
+                w = b[3]<<8 | b[4];
+                return true;
+            }
+            fin.seekg(length - 2, std::ios::cur);
+        }
+        return false;
+    }
+    SDL_Surface *s = loadImage(file_name.c_str());
+    if(s == NULL)
+        return false;
+    w = s->w;
+    h = s->h;
+    SDL_FreeSurface(s);
+    return true;
+}
+/**
 Loads a SDL_Texture from an image file and color keys it
 */
 SDL_Texture *loadTexture(const char *name, uint8_t r, uint8_t g, uint8_t b)
 {
-    SDL_Surface *s = IMG_Load(name);
+    TRACE_SCOPE("loadTexture");
+    SDL_Surface *s = loadImage(name);
     if(s == NULL)
     {
-        println("IMG_GetError(): " + (std::string)SDL_GetError());
+        logError("IMG_GetError(): %s", SDL_GetError());
         return NULL;
     }
     SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGB(s->format, r, g, b));
@@ -887,19 +1208,218 @@ SDL_Texture *loadTexture(const char *name, uint8_t r, uint8_t g, uint8_t b)
     return t;
 }
 /**
+Loads a SDL_Texture from an image file, color keys it, and fills in opaqueRect with getOpaqueRect() of the image
+*/
+SDL_Texture *loadTexture(const char *name, uint8_t r, uint8_t g, uint8_t b, SDL_Rect *opaqueRect)
+{
+    TRACE_SCOPE("loadTexture");
+    *opaqueRect = SDL_Rect{0, 0, 0, 0};
+    SDL_Surface *s = loadImage(name);
+    if(s == NULL)
+    {
+        logError("IMG_GetError(): %s", SDL_GetError());
+        return NULL;
+    }
+    SDL_Texture *t = createTexture(s, r, g, b, opaqueRect);
+    SDL_FreeSurface(s);
+    return t;
+}
+/**
 Loads a SDL_Texture from an image file
 */
 SDL_Texture *loadTexture(const char *name)
 {
-    SDL_Surface *s = IMG_Load(name);
+    TRACE_SCOPE("loadTexture");
+    SDL_Surface *s = loadImage(name);
     if(s == NULL)
-        println("IMG_GetError(): " + (std::string)SDL_GetError());
+        logError("IMG_GetError(): %s", SDL_GetError());
     SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
     SDL_FreeSurface(s);
     SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
     return t;
 }
 /**
+Creates a SDL_Texture from a surface, color keys it, and fills in opaqueRect with getOpaqueRect() of the surface
+*/
+SDL_Texture *createTexture(SDL_Surface *s, uint8_t r, uint8_t g, uint8_t b, SDL_Rect *opaqueRect)
+{
+    TRACE_SCOPE("createTexture");
+    SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGB(s->format, r, g, b));
+    *opaqueRect = getOpaqueRect(s);
+    SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
+    SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
+    return t;
+}
+/**
+Creates a SDL_Texture from a surface, keeping its color key if it has one
+*/
+SDL_Texture *createTexture(SDL_Surface *s)
+{
+    TRACE_SCOPE("createTexture");
+    SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
+    SDL_SetTextureBlendMode(t, SDL_BLENDMODE_BLEND);
+    return t;
+}
+/**
+Returns the largest rectangle of a surface in which every pixel is fully opaque and not color keyed (w and h are 0 if there is none)
+*/
+SDL_Rect getOpaqueRect(SDL_Surface *s)
+{
+    SDL_Rect best{0, 0, 0, 0};
+    Uint32 key;
+    bool keyed = SDL_GetColorKey(s, &key) == 0;
+    uint8_t kr = 0, kg = 0, kb = 0, ka;
+    if(keyed)
+        SDL_GetRGBA(key, s->format, &kr, &kg, &kb, &ka);
+    SDL_Surface *c = SDL_ConvertSurfaceFormat(s, SDL_PIXELFORMAT_RGBA32, 0);
+    if(c == NULL)
+        return best;
+    //largest rectangle in a histogram, where height[x] is the number of opaque pixels directly above and including (x, y)
+    std::vector<int> height(c->w, 0), stk;
+    for(int y=0; y<c->h; y++)
+    {
+        uint8_t *row = (uint8_t*)c->pixels + y * c->pitch;
+        for(int x=0; x<c->w; x++)
+        {
+            uint8_t *p = row + x*4;
+            bool opaque = p[3]==255 && !(keyed && p[0]==kr && p[1]==kg && p[2]==kb);
+            height[x] = opaque? height[x] + 1 : 0;
+        }
+        stk.clear();
+        for(int x=0; x<=c->w; x++)
+        {
+            int cur = x<c->w? height[x] : 0;
+            while(!stk.empty() && height[stk.back()] >= cur)
+            {
+                int top = height[stk.back()];
+                stk.pop_back();
+                int left = stk.empty()? 0 : stk.back() + 1;
+                if((long long)top * (x - left) > (long long)best.w * best.h)
+                    best = SDL_Rect{left, y - top + 1, x - left, top};
+            }
+            stk.push_back(x);
+        }
+    }
+    SDL_FreeSurface(c);
+    return best;
+}
+AsyncJob::AsyncJob(): done(false){}
+AsyncJob::~AsyncJob(){}
+AsyncSurface::AsyncSurface(const std::string &file_name): file_name(file_name), surface(NULL), keyed(false), key{0, 0, 0, 255},
+    opaque{0, 0, 0, 0}{}
+AsyncSurface::~AsyncSurface()
+{
+    if(surface != NULL)
+        SDL_FreeSurface(surface);
+}
+void AsyncSurface::run()
+{
+    surface = loadImage(file_name.c_str());
+    if(surface == NULL)
+        logError("IMG_GetError(): %s", SDL_GetError());
+    else if(keyed)
+    {
+        SDL_SetColorKey(surface, SDL_TRUE, SDL_MapRGB(surface->format, key.r, key.g, key.b));
+        opaque = getOpaqueRect(surface);
+    }
+}
+//background image decoding for loadSurfaceAsync and runAsync. It's never destroyed, so the worker threads can simply be left running
+//at exit.
+struct SurfaceLoader
+{
+    std::mutex m;
+    std::condition_variable cv, finished;
+    std::deque<std::shared_ptr<AsyncJob> > jobs;
+    std::atomic<int> pending{0};
+    void work()
+    {
+        traceThreadName("decoder");
+        while(true)
+        {
+            std::shared_ptr<AsyncJob> job;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [this]{return !jobs.empty();});
+                job = jobs.back();
+                jobs.pop_back();
+            }
+            if(job.use_count() > 1) //otherwise nobody wants it any more
+                job->run();
+            job->done = true;
+            pending--;
+            {
+                std::lock_guard<std::mutex> lock(m); //so waitForSurface can't miss the notification between checking done and waiting
+            }
+            finished.notify_all();
+        }
+    }
+};
+static SurfaceLoader *getSurfaceLoader()
+{
+    static SurfaceLoader *loader = NULL;
+    static std::once_flag started;
+    std::call_once(started, []
+    {
+        loader = new SurfaceLoader;
+        int n = std::max(1, std::min(4, (int)std::thread::hardware_concurrency() - 1));
+        for(int i=0; i<n; i++)
+            std::thread(&SurfaceLoader::work, loader).detach();
+    });
+    return loader;
+}
+/**
+Queues a job to run on the background threads used by loadSurfaceAsync, in the same most recently queued first order. A job is
+skipped (but still marked done) if every other reference to it is dropped before it runs.
+*/
+void runAsync(const std::shared_ptr<AsyncJob> &job)
+{
+    SurfaceLoader *loader = getSurfaceLoader();
+    loader->pending++;
+    {
+        std::lock_guard<std::mutex> lock(loader->m);
+        loader->jobs.push_back(job);
+    }
+    loader->cv.notify_one();
+}
+/**
+Queues an image file to be decoded into an SDL_Surface on a background thread. The most recently queued files are decoded first,
+and a file is skipped if every other reference to its AsyncSurface is dropped before it's decoded.
+*/
+std::shared_ptr<AsyncSurface> loadSurfaceAsync(const std::string &file_name)
+{
+    auto job = std::make_shared<AsyncSurface>(file_name);
+    runAsync(job);
+    return job;
+}
+/**
+Queues an image file to be decoded like loadSurfaceAsync(file_name), and also color keys it and finds its getOpaqueRect() on the
+background thread, so the thread that uploads it with createTexture(SDL_Surface*) doesn't have to scan it
+*/
+std::shared_ptr<AsyncSurface> loadSurfaceAsync(const std::string &file_name, uint8_t r, uint8_t g, uint8_t b)
+{
+    auto job = std::make_shared<AsyncSurface>(file_name);
+    job->keyed = true;
+    job->key = SDL_Color{r, g, b, 255};
+    runAsync(job);
+    return job;
+}
+/**
+Blocks until an image file queued by loadSurfaceAsync has been decoded
+*/
+void waitForSurface(AsyncSurface &s)
+{
+    SurfaceLoader *loader = getSurfaceLoader();
+    std::unique_lock<std::mutex> lock(loader->m);
+    loader->finished.wait(lock, [&]{return s.done.load();});
+}
+/**
+Returns the number of image files (and other runAsync jobs) queued or being worked on by the background threads
+*/
+int getPendingSurfaceLoads()
+{
+    return getSurfaceLoader()->pending;
+}
+/**
 Checks if two rectangles intersect
 */
 bool rectsIntersect(SDL_Rect a, SDL_Rect b)
@@ -913,7 +1433,20 @@ Equivalent to SDL_RenderDrawLine
 */
 void drawLine(int x1, int y1, int x2, int y2)
 {
-    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+    if(x1 == x2 || y1 == y2)
+    {
+        queuePrimitive(FILLED_RECTS);
+        pendingRects.push_back(SDL_Rect{std::min(x1, x2), std::min(y1, y2), std::abs(x2 - x1) + 1, std::abs(y2 - y1) + 1});
+        return;
+    }
+    queuePrimitive(LINES);
+    //a line starting where the last one ended continues its run
+    if(pendingPoints.empty() || pendingPoints.back().x != x1 || pendingPoints.back().y != y1)
+    {
+        pendingLineStarts.push_back(pendingPoints.size());
+        pendingPoints.push_back(SDL_Point{x1, y1});
+    }
+    pendingPoints.push_back(SDL_Point{x2, y2});
 }
 /**
 Equivalent to SDL_RenderDrawLine
@@ -928,7 +1461,8 @@ Equivalent to SDL_RenderDrawPoint
 */
 void drawPoint(int x, int y)
 {
-    SDL_RenderDrawPoint(renderer, x, y);
+    queuePrimitive(POINTS);
+    pendingPoints.push_back(SDL_Point{x, y});
 }
 /**
 Equivalent to SDL_RenderDrawPoint
@@ -936,7 +1470,7 @@ Equivalent to SDL_RenderDrawPoint
 void drawPoint(int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
     setColor(r, g, b, a);
-    SDL_RenderDrawPoint(renderer, x, y);
+    drawPoint(x, y);
 }
 /**
 Draws a filled circle
@@ -971,15 +1505,7 @@ Draws an unfilled circle
 */
 void drawCircle(int x, int y, int r)
 {
-    int r2 = r*r + 0.000001; //taking the square root of a negative number might cacuse crashes
-    for(int dX=0; dX<=r; dX++)
-    {
-        int dY = sqrt(r2 - dX*dX);
-        drawPoint(x-dX, y-dY);
-        drawPoint(x-dX, y+dY);
-        drawPoint(x+dX, y-dY);
-        drawPoint(x+dX, y+dY);
-    }
+    drawRing(x, y, r);
 }
 /**
 Draws an unfilled circle
@@ -989,6 +1515,62 @@ void drawCircle(int x, int y, int rad, uint8_t r, uint8_t g, uint8_t b, uint8_t
     setColor(r, g, b, a);
     drawCircle(x, y, rad);
 }
+//rings bigger than this (in pixels) are skipped, since the angles and points of their arcs lose too much precision
+static const double MAX_RING_RADIUS = 1e9;
+/**
+Draws an unfilled circle as one polyline, with segments short enough to stay within half a pixel of the circle. Only the arc that
+crosses the viewport is drawn, so circles far larger than the screen are as cheap as small ones.
+*/
+void drawRing(double x, double y, double rad)
+{
+    const double PI = std::acos(-1.0);
+    if(!(rad <= MAX_RING_RADIUS))
+        return;
+    SDL_Rect v;
+    SDL_RenderGetViewport(renderer, &v);
+    //the viewport, with a pixel of margin, relative to the center
+    double x1 = -1 - x, y1 = -1 - y, x2 = v.w + 1 - x, y2 = v.h + 1 - y;
+    double near_x = std::max(x1, std::min(0.0, x2)), near_y = std::max(y1, std::min(0.0, y2));
+    double far_x = std::max(-x1, x2), far_y = std::max(-y1, y2);
+    if(rad < 0.5 || rad*rad < near_x*near_x + near_y*near_y || rad*rad > far_x*far_x + far_y*far_y)
+        return;
+    double step = std::min(PI / 4, 2 * std::acos(1 - 0.5 / std::max(rad, 0.5)));
+    double a1 = 0, a2 = 2 * PI;
+    if(near_x != 0 || near_y != 0) //the center is outside the viewport, so the viewport spans less than half a turn around it
+    {
+        double mid = std::atan2((y1 + y2) / 2, (x1 + x2) / 2);
+        a1 = INFINITY;
+        a2 = -INFINITY;
+        for(double cx: {x1, x2})
+        {
+            for(double cy: {y1, y2})
+            {
+                double a = mid + std::remainder(std::atan2(cy, cx) - mid, 2 * PI);
+                a1 = std::min(a1, a);
+                a2 = std::max(a2, a);
+            }
+        }
+    }
+    int n = std::max(1, (int)std::ceil((a2 - a1) / step));
+    queuePrimitive(LINES);
+    pendingLineStarts.push_back(pendingPoints.size());
+    for(int i=0; i<=n; i++)
+    {
+        //points between the viewport's corners can bulge far outside it, clamped so they still fit in an int
+        double a = a1 + (a2 - a1) * i / n;
+        double px = std::max(-MAX_RING_RADIUS, std::min(MAX_RING_RADIUS, x + rad*std::cos(a)));
+        double py = std::max(-MAX_RING_RADIUS, std::min(MAX_RING_RADIUS, y + rad*std::sin(a)));
+        pendingPoints.push_back(SDL_Point{(int)std::lround(px), (int)std::lround(py)});
+    }
+}
+/**
+Draws an unfilled circle like drawRing(x, y, rad) in the given color
+*/
+void drawRing(double x, double y, double rad, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    setColor(r, g, b, a);
+    drawRing(x, y, rad);
+}
 /**
 Checks if the mouse is in a given rectangle
 */
@@ -1022,6 +1604,7 @@ Equivalent to SDL_RenderSetViewport
 */
 void setViewport(SDL_Rect *x)
 {
+    flushPrimitives();
     SDL_RenderSetViewport(renderer, x);
 }
 /**
@@ -1030,6 +1613,7 @@ Equivalent to SDL_RenderSetViewport
 void setViewport(int x, int y, int w, int h)
 {
     SDL_Rect r{x, y, w, h};
+    flushPrimitives();
     SDL_RenderSetViewport(renderer, &r);
 }
 /*
@@ -1037,6 +1621,7 @@ Equivalent to SDL_RenderSetClipRect
 */
 void setClipRect(SDL_Rect *x)
 {
+    flushPrimitives();
     SDL_RenderSetClipRect(renderer, x);
 }
 /**
@@ -1045,9 +1630,19 @@ Equivalent to SDL_RenderSetClipRect
 void setClipRect(int x, int y, int w, int h)
 {
     SDL_Rect r{x, y, w, h};
+    flushPrimitives();
     SDL_RenderSetClipRect(renderer, &r);
 }
 /**
+Shows or hides the window. Drawing still works while it's hidden, for example to feed startSharedMemoryOutput.
+*/
+void setWindowVisible(bool visible)
+{
+    if(visible)
+        SDL_ShowWindow(window);
+    else SDL_HideWindow(window);
+}
+/**
 Equivalent to SDL_SetWindowIcon
 */
 void setWindowIcon(SDL_Surface *icon)
@@ -1059,7 +1654,7 @@ Returns a pointer to TTF_Font of size 2^pos
 */
 TTF_Font *getFont(int pos)
 {
-    return font[pos];
+    return getFontAt(pos);
 }
 /**
 Sets the color of the FPS counter
@@ -1086,6 +1681,27 @@ SDL_Renderer *getRenderer()
 {
     return renderer;
 }
+static SDL_GLContext rendererContext = NULL; //saved by releaseRenderer() for acquireRenderer()
+/**
+Releases the renderer's OpenGL context (if it uses one) from the calling thread, so that another thread can draw after calling
+acquireRenderer(). Only one thread may draw at a time.
+*/
+void releaseRenderer()
+{
+    flushPrimitives();
+    //a context can only be current on one thread, and the renderer only makes it current again when it isn't on the drawing thread
+    rendererContext = SDL_GL_GetCurrentContext();
+    if(rendererContext != NULL)
+        SDL_GL_MakeCurrent(window, NULL);
+}
+/**
+Makes the renderer's OpenGL context (if it uses one) current on the calling thread, after the last thread to draw called releaseRenderer()
+*/
+void acquireRenderer()
+{
+    if(rendererContext != NULL && SDL_GL_MakeCurrent(window, rendererContext) != 0)
+        logError("SDL_GetError(): %s", SDL_GetError());
+}
 /**
 Changes how long text textures are cached for
 */
@@ -1108,24 +1724,467 @@ void setRendererAA(int q)
     sdl_settings::renderScaleQuality = q;
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, to_str(q).c_str());
 }
+//a frame that makes its vblank takes up to about a refresh interval, including the wait in SDL_RenderPresent
+static const double VSYNC_SLACK = 1.2;
+/**
+Adjusts the dynamic resolution scale once a frame drawn with beginScaledRender() has been presented. ms is the time spent drawing it
+plus the time blocked in SDL_RenderPresent, which is where the GPU's fill cost shows up, since SDL batches the draw calls.
+*/
+static void updateRenderScale(double ms)
+{
+    using namespace sdl_settings;
+    //with vsync, the wait for the vblank can't be told apart from the GPU catching up, so frames that make their vblank are always
+    //within the budget, and only frames that miss it can be over it
+    double budget = frameTimeBudget;
+    if(vsync)
+        budget = std::max(budget, VSYNC_SLACK * 1000 / getDisplayHertz());
+    avgScaledFrameMs = avgScaledFrameMs==0? ms : avgScaledFrameMs*0.9 + ms*0.1;
+    if(avgScaledFrameMs > budget) //fill cost goes with the square of the scale
+        renderScale = std::max(MIN_RENDER_SCALE, renderScale * std::sqrt(budget / avgScaledFrameMs));
+    else if(avgScaledFrameMs < budget * 0.85)
+        renderScale = std::min(1.0, renderScale * 1.01);
+}
+//frame capture: while capturing, each frame is drawn into one of the captureSlots instead of the window, copied to the window when
+//it's presented, and read back just before the next frame is presented. That only defers the readback by a frame, it doesn't stop
+//it from stalling: SDL_RenderReadPixels is a synchronous readback that waits for the GPU to finish everything queued so far, and
+//SDL's API has no pixel buffer objects or fences to read back asynchronously with. What stays off the render thread is encoding
+//and writing the frames.
+struct CaptureSlot
+{
+    SDL_Texture *t = NULL;
+    std::string file_name; //where the frame drawn into t goes, empty once it has been read back
+    bool screenshot = false;
+    bool shared = false; //goes to the shared memory output
+    bool pending() const
+    {
+        return !file_name.empty() || shared;
+    }
+};
+static const int CAPTURE_SLOTS = 3;
+static const size_t MAX_QUEUED_CAPTURES = 8; //frames waiting to be written, later ones are dropped rather than stalling rendering
+struct CapturedFrame
+{
+    std::vector<uint8_t> pixels; //RGBA
+    int w, h;
+    std::string file_name;
+};
+//encodes and writes captured frames on a background thread. It's never destroyed, like SurfaceLoader.
+struct CaptureWriter
+{
+    std::mutex m;
+    std::condition_variable cv, idle;
+    std::deque<CapturedFrame> frames;
+    std::vector<std::vector<uint8_t> > free_buffers; //pixel buffers of written frames, reused for later ones
+    bool writing = false;
+    void work()
+    {
+        traceThreadName("capture writer");
+        while(true)
+        {
+            CapturedFrame f;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [this]{return !frames.empty();});
+                f = std::move(frames.front());
+                frames.pop_front();
+                writing = true;
+            }
+            const std::string &n = f.file_name;
+            if(n.size() > 4 && n.compare(n.size() - 4, 4, ".png") == 0)
+            {
+                SDL_Surface *s = SDL_CreateRGBSurfaceWithFormatFrom(f.pixels.data(), f.w, f.h, 32, f.w * 4, SDL_PIXELFORMAT_RGBA32);
+                if(s == NULL || IMG_SavePNG(s, n.c_str()) != 0)
+                    logError("Failed to save %s: %s", n, SDL_GetError());
+                if(s != NULL)
+                    SDL_FreeSurface(s);
+            }
+            else
+            {
+                std::ofstream fout(n, std::ios::binary);
+                fout.write((const char*)f.pixels.data(), f.pixels.size());
+                if(fout.fail())
+                    logError("Failed to save %s", n);
+            }
+            std::lock_guard<std::mutex> lock(m);
+            free_buffers.push_back(std::move(f.pixels));
+            writing = false;
+            if(frames.empty())
+                idle.notify_all();
+        }
+    }
+};
+#ifdef __linux__
+//the shared memory frame ring for startSharedMemoryOutput, see shm_frames.h
+struct SharedFrameOutput
+{
+    std::string name;
+    ShmFramesHeader *header = NULL;
+    size_t size = 0;
+    bool failed = false; //don't keep trying (and printing errors) every frame
+    bool open(int w, int h)
+    {
+        close();
+        //a new object every time, so a reader still mapping an old one (or waiting on its semaphore) is never reinitialized under it
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        ShmFramesHeader layout;
+        layout.height = h;
+        layout.pitch = w * 4;
+        size = shmFramesSize(layout);
+        if(fd < 0 || ftruncate(fd, size) != 0)
+        {
+            logError("Failed to create shared memory %s", name);
+            if(fd >= 0)
+                ::close(fd);
+            failed = true;
+            return false;
+        }
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED)
+        {
+            logError("Failed to map shared memory %s", name);
+            failed = true;
+            return false;
+        }
+        header = new(p) ShmFramesHeader;
+        header->width = w;
+        header->height = h;
+        header->pitch = w * 4;
+        header->closed = 0;
+        header->sequence = 0;
+        for(auto &s: header->slot_sequence)
+            s = 0;
+        sem_init(&header->frame_ready, 1, 0);
+        header->magic.store(SHM_FRAMES_MAGIC, std::memory_order_release);
+        return true;
+    }
+    void close()
+    {
+        if(header == NULL)
+            return;
+        header->closed = 1;
+        sem_post(&header->frame_ready); //wake up readers so they notice
+        munmap(header, size);
+        shm_unlink(name.c_str()); //readers keep their mappings until they let go
+        header = NULL;
+    }
+    //returns where to write the next frame, or NULL
+    uint8_t *beginFrame(int w, int h, int &pitch)
+    {
+        if(header == NULL || (int)header->width != w || (int)header->height != h)
+        {
+            if(failed || !open(w, h))
+                return NULL;
+        }
+        uint64_t next = header->sequence + 1;
+        header->slot_sequence[next % SHM_FRAME_SLOTS] = 0;
+        pitch = header->pitch;
+        return (uint8_t*)header + shmFrameOffset(*header, next % SHM_FRAME_SLOTS);
+    }
+    void endFrame()
+    {
+        uint64_t next = header->sequence + 1;
+        header->slot_sequence[next % SHM_FRAME_SLOTS] = next;
+        header->sequence = next;
+        sem_post(&header->frame_ready);
+    }
+};
+static SharedFrameOutput sharedOutput;
+#endif
+static CaptureSlot captureSlots[CAPTURE_SLOTS];
+static int captureSlot = 0, captureW = 0, captureH = 0;
+static SDL_Texture *frameTarget = NULL; //what drawing to the window actually draws into
+//requests from any thread, picked up by updateScreen
+static std::mutex captureRequestMutex;
+static std::string screenshotRequest, captureRequestPrefix, sharedOutputRequest;
+static std::atomic<int> pendingScreenshots{0}; //requested but not read back yet
+//continuous capture on the rendering thread
+static std::string capturePrefix, sharedOutputName;
+static int captureIndex = 0, droppedCaptures = 0;
+static CaptureWriter *captureWriter = NULL;
+static CaptureWriter *getCaptureWriter()
+{
+    static std::once_flag started;
+    std::call_once(started, []
+    {
+        captureWriter = new CaptureWriter;
+        std::thread(&CaptureWriter::work, captureWriter).detach();
+    });
+    return captureWriter;
+}
+/**
+Hands a capture slot's frame to the writer thread if it's going to a file, or drops it if the writer has fallen too far behind. The
+pixels are copied from shared (pitch captureW * 4) if the frame was already read back there, otherwise they're read back.
+*/
+static void queueCapturedFrame(CaptureSlot &s, const uint8_t *shared)
+{
+    if(s.file_name.empty())
+        return;
+    CaptureWriter *writer = getCaptureWriter();
+    CapturedFrame f;
+    f.w = captureW;
+    f.h = captureH;
+    f.file_name.swap(s.file_name);
+    if(s.screenshot)
+        pendingScreenshots--;
+    s.screenshot = false;
+    {
+        std::lock_guard<std::mutex> lock(writer->m);
+        if(writer->frames.size() >= MAX_QUEUED_CAPTURES)
+        {
+            droppedCaptures++;
+            return;
+        }
+        if(!writer->free_buffers.empty())
+        {
+            f.pixels.swap(writer->free_buffers.back());
+            writer->free_buffers.pop_back();
+        }
+    }
+    f.pixels.resize((size_t)f.w * f.h * 4);
+    if(shared != NULL)
+        std::copy(shared, shared + f.pixels.size(), f.pixels.begin());
+    else
+    {
+        SDL_SetRenderTarget(renderer, s.t);
+        SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGBA32, f.pixels.data(), f.w * 4);
+    }
+    {
+        std::lock_guard<std::mutex> lock(writer->m);
+        writer->frames.push_back(std::move(f));
+    }
+    writer->cv.notify_one();
+}
+/**
+Reads back a capture slot once, into shared memory and/or for the writer thread
+*/
+static void readBackCaptureSlot(CaptureSlot &s)
+{
+#ifdef __linux__
+    int pitch;
+    uint8_t *dst;
+    if(s.shared && (dst = sharedOutput.beginFrame(captureW, captureH, pitch)) != NULL)
+    {
+        s.shared = false;
+        SDL_SetRenderTarget(renderer, s.t);
+        SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGBA32, dst, pitch);
+        queueCapturedFrame(s, dst);
+        sharedOutput.endFrame();
+        return;
+    }
+#endif
+    s.shared = false;
+    queueCapturedFrame(s, NULL);
+}
+/**
+Reads back every capture slot still holding a frame, oldest first
+*/
+static void readBackCaptureSlots()
+{
+    for(int i=1; i<=CAPTURE_SLOTS; i++)
+    {
+        CaptureSlot &s = captureSlots[(captureSlot + i) % CAPTURE_SLOTS];
+        if(s.pending())
+            readBackCaptureSlot(s);
+    }
+}
+/**
+Called before presenting: reads back the frames before this one and copies this one to the window
+*/
+static void finishCaptureFrame()
+{
+    if(frameTarget == NULL)
+        return;
+    for(int i=1; i<CAPTURE_SLOTS; i++)
+    {
+        CaptureSlot &s = captureSlots[(captureSlot + i) % CAPTURE_SLOTS];
+        if(s.pending())
+            readBackCaptureSlot(s);
+    }
+    SDL_SetRenderTarget(renderer, NULL);
+    SDL_RenderCopy(renderer, frameTarget, NULL, NULL);
+}
+/**
+Called after presenting: picks up capture requests and, if the next frame is to be captured, redirects drawing into a free slot
+*/
+static void beginCaptureFrame()
+{
+    std::string shot;
+    {
+        std::lock_guard<std::mutex> lock(captureRequestMutex);
+        shot.swap(screenshotRequest);
+        if(capturePrefix != captureRequestPrefix)
+        {
+            capturePrefix = captureRequestPrefix;
+            captureIndex = 0;
+        }
+        if(sharedOutputName != sharedOutputRequest)
+            sharedOutputName = sharedOutputRequest;
+    }
+#ifdef __linux__
+    if(sharedOutput.name != sharedOutputName)
+    {
+        sharedOutput.close();
+        sharedOutput.name = sharedOutputName;
+        sharedOutput.failed = false;
+    }
+#endif
+    int w = getWindowW(), h = getWindowH();
+    bool active = !shot.empty() || !capturePrefix.empty() || !sharedOutputName.empty();
+    if(!active || w != captureW || h != captureH)
+    {
+        if(frameTarget != NULL)
+        {
+            readBackCaptureSlots();
+            SDL_SetRenderTarget(renderer, NULL);
+            frameTarget = NULL;
+            if(droppedCaptures > 0)
+                logWarning("Capture fell behind and dropped %d frames", droppedCaptures);
+            droppedCaptures = 0;
+        }
+        if(!active)
+            return;
+    }
+    if(w != captureW || h != captureH)
+    {
+        for(auto &s: captureSlots)
+        {
+            if(s.t != NULL)
+                SDL_DestroyTexture(s.t);
+            s.t = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+            if(s.t == NULL)
+                logError("SDL_GetError(): %s", SDL_GetError());
+        }
+        captureW = w;
+        captureH = h;
+    }
+    captureSlot = (captureSlot + 1) % CAPTURE_SLOTS;
+    CaptureSlot &s = captureSlots[captureSlot];
+    if(s.pending())
+        readBackCaptureSlot(s);
+    if(s.t == NULL)
+    {
+        if(!shot.empty())
+            pendingScreenshots--;
+        return;
+    }
+    if(!shot.empty()) //a screenshot taken while capturing continuously replaces that frame
+    {
+        s.file_name = shot;
+        s.screenshot = true;
+    }
+    else if(!capturePrefix.empty())
+    {
+        char num[16];
+        snprintf(num, sizeof(num), "%06d", captureIndex++);
+        if(sdl_settings::captureRaw)
+            s.file_name = capturePrefix + num + "_" + to_str(w) + "x" + to_str(h) + ".rgba";
+        else s.file_name = capturePrefix + num + ".png";
+    }
+    s.shared = !sharedOutputName.empty();
+    frameTarget = s.t;
+    SDL_SetRenderTarget(renderer, frameTarget);
+}
+/**
+Saves the next frame presented by updateScreen to a PNG file. Can be called from any thread.
+*/
+void takeScreenshot(const std::string &file_name)
+{
+    std::lock_guard<std::mutex> lock(captureRequestMutex);
+    if(screenshotRequest.empty())
+        pendingScreenshots++;
+    screenshotRequest = file_name;
+}
+/**
+Saves every frame presented by updateScreen, numbered from 0, to prefix000000.png and so on, or as raw RGBA to
+prefix000000_WxH.rgba if CAPTURE_RAW is set. Can be called from any thread.
+*/
+void startCapture(const std::string &prefix)
+{
+    std::lock_guard<std::mutex> lock(captureRequestMutex);
+    captureRequestPrefix = prefix;
+}
+/**
+Stops saving frames started by startCapture
+*/
+void stopCapture()
+{
+    std::lock_guard<std::mutex> lock(captureRequestMutex);
+    captureRequestPrefix.clear();
+}
+/**
+Returns true between startCapture and stopCapture, or while a screenshot hasn't been taken yet. Frames have to keep being
+presented until it returns false.
+*/
+bool isCapturing()
+{
+    std::lock_guard<std::mutex> lock(captureRequestMutex);
+    return !captureRequestPrefix.empty() || !sharedOutputRequest.empty() || pendingScreenshots > 0;
+}
+/**
+Writes every frame presented by updateScreen into the POSIX shared memory object name, a ring of frames laid out as in
+shm_frames.h, for other processes on the same host to read. Returns false where that isn't supported (only Linux is). Can be
+called from any thread.
+*/
+bool startSharedMemoryOutput(const std::string &name)
+{
+#ifdef __linux__
+    std::lock_guard<std::mutex> lock(captureRequestMutex);
+    sharedOutputRequest = name[0] == '/'? name : "/" + name;
+    return true;
+#else
+    logWarning("Shared memory output isn't supported on this platform");
+    return false;
+#endif
+}
+/**
+Stops the shared memory output started by startSharedMemoryOutput
+*/
+void stopSharedMemoryOutput()
+{
+    std::lock_guard<std::mutex> lock(captureRequestMutex);
+    sharedOutputRequest.clear();
+}
+/**
+Waits until every captured frame has been written and closes the shared memory output. Call it once rendering has stopped.
+*/
+void finishCaptures()
+{
+#ifdef __linux__
+    sharedOutput.close();
+#endif
+    CaptureWriter *writer = captureWriter;
+    if(writer == NULL)
+        return;
+    std::unique_lock<std::mutex> lock(writer->m);
+    writer->idle.wait(lock, [writer]{return writer->frames.empty() && !writer->writing;});
+}
 /**
 Updates the screen and performs some other functions. This function is called to advance to the next frame.
 */
 void updateScreen()
 {
+    //idle time between frames isn't counted, so only frames that began a scaled render are measured, and the FPS cap's sleep isn't
+    //counted either
+    long long scaledNs = scaledFrameStart >= 0? getTicksNs() - scaledFrameStart : -1;
+    scaledFrameStart = -1;
     int curTick = getTicks();
     //clear unused text SDL_Textures
     static int last_check = 0, check_interval = 1000;
     if(curTick - last_check > check_interval) //the SDL_Texture cache doesn't need to be cleared every frame
     {
+        TRACE_SCOPE("evictTextCache");
         last_check = curTick;
-        for(auto i = text_textures.begin(); i!=text_textures.end(); i++)
+        for(auto i = text_textures.begin(); i!=text_textures.end(); )
         {
             if(curTick - i->second.first > sdl_settings::TEXT_TEXTURE_CACHE_TIME)
             {
+                stats.text_cache_bytes -= getTextureBytes(i->second.second);
                 SDL_DestroyTexture(i->second.second);
                 i = text_textures.erase(i);
             }
+            else i++;
         }
     }
     using namespace sdl_settings;
@@ -1135,7 +2194,11 @@ void updateScreen()
     if((int)frameTimeStamp.size() >= FPS_CAP)
         std::this_thread::sleep_for((std::chrono::nanoseconds)(1000000000/FPS_CAP));
     if(showFPS)
-        drawText(to_str(frameTimeStamp.size()) + " FPS", 0, 0, WINDOW_H/40, fpsR, fpsG, fpsB, fpsA);
+    {
+        char fps[32];
+        snprintf(fps, sizeof(fps), "%d FPS", (int)frameTimeStamp.size());
+        drawTextChars(fps, 0, 0, WINDOW_H/40, fpsR, fpsG, fpsB, fpsA);
+    }
     /*
     //for some reason in Windows 10, the program sometimes must be busy when minimizing or else it'll crash when restoring, which is obviously bad,
     //and sleeping for a few ms keeps it "busy." This doesn't happen all the time though... it's a bit inconsistent.
@@ -1149,7 +2212,30 @@ void updateScreen()
     frameLength = curTick - prevTick;
     prevTick = curTick;
     SDL_GetMouseState(&mouse_x, &mouse_y);
-    SDL_RenderPresent(getRenderer());
+    flushPrimitives();
+    finishCaptureFrame();
+    {
+        TRACE_SCOPE("present");
+        long long presentStart = getTicksNs();
+        SDL_RenderPresent(getRenderer());
+        if(scaledNs >= 0)
+            updateRenderScale((scaledNs + getTicksNs() - presentStart) / 1e6);
+    }
+    beginCaptureFrame();
+    long long ns = getTicksNs();
+    if(lastPresentNs >= 0)
+        stats.frame_ms[stats.frames++ % RenderStats::HISTORY] = (ns - lastPresentNs) / 1e6;
+    lastPresentNs = ns;
+    stats.draw_calls = drawCalls;
+    drawCalls = 0;
+    stats.text_cache_size = text_textures.size();
+    static AllocCounts lastAllocs;
+    AllocCounts allocs = getThreadAllocs();
+    stats.allocs = allocs.count - lastAllocs.count;
+    stats.alloc_bytes = allocs.bytes - lastAllocs.bytes;
+    if(stats.allocs > 0)
+        stats.alloc_frames++;
+    lastAllocs = allocs;
 }
 /**
 Returns the window's width
@@ -1230,15 +2316,27 @@ Sets the renderer target
 */
 bool setRenderTarget(SDL_Texture *t)
 {
-    return SDL_SetRenderTarget(renderer, t);
+    flushPrimitives();
+    return SDL_SetRenderTarget(renderer, t != NULL? t : frameTarget);
 }
 /**
 Returns the intermediate texture that effectively represents the display
 */
 SDL_Texture *getScreenTexture()
 {
+    if(frameTarget != NULL) //copy on the GPU instead of reading back
+    {
+        flushPrimitives();
+        SDL_Texture *t = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, captureW, captureH);
+        SDL_Texture *cur = SDL_GetRenderTarget(renderer);
+        SDL_SetRenderTarget(renderer, t);
+        SDL_RenderCopy(renderer, frameTarget, NULL, NULL);
+        SDL_SetRenderTarget(renderer, cur);
+        return t;
+    }
     int w = getWindowW(), h = getWindowH();
     SDL_Surface *s = SDL_CreateRGBSurface(0, w, h, 32, 0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff);
+    flushPrimitives();
     SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGBA8888, s->pixels, s->pitch);
     SDL_Texture *t = SDL_CreateTextureFromSurface(renderer, s);
     SDL_FreeSurface(s);
@@ -1281,6 +2379,23 @@ void setTextSizeMult(double m)
     sdl_settings::textSizeMult = m;
 }
 /**
+Returns the counters of the last frame presented by updateScreen
+*/
+const RenderStats &getRenderStats()
+{
+    return stats;
+}
+/**
+Returns how much memory a texture takes up, assuming 4 bytes per pixel
+*/
+long long getTextureBytes(SDL_Texture *t)
+{
+    int w, h;
+    if(t == NULL || SDL_QueryTexture(t, NULL, NULL, &w, &h) != 0)
+        return 0;
+    return 4LL * w * h;
+}
+/**
 Returns the current FPS
 */
 int getFPS()
@@ -1288,15 +2403,66 @@ int getFPS()
     return sdl_settings::frameTimeStamp.size();
 }
 /**
+Redirects drawing into an offscreen target whose resolution is lowered when frames take longer than FRAME_TIME_BUDGET.
+Coordinates stay in window pixels. Does nothing unless DYNAMIC_RESOLUTION is set.
+*/
+void beginScaledRender()
+{
+    if(!sdl_settings::dynamicResolution)
+        return;
+    int w = getWindowW(), h = getWindowH();
+    if(scaledTarget == NULL || scaledTargetW != w || scaledTargetH != h)
+    {
+        if(scaledTarget != NULL)
+            SDL_DestroyTexture(scaledTarget);
+        scaledTarget = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+        scaledTargetW = w;
+        scaledTargetH = h;
+        if(scaledTarget == NULL)
+        {
+            logError("SDL_GetError(): %s", SDL_GetError());
+            return;
+        }
+    }
+    scaledFrameStart = getTicksNs();
+    scaledRenderActive = true;
+    flushPrimitives();
+    SDL_SetRenderTarget(renderer, scaledTarget);
+    SDL_RenderSetScale(renderer, renderScale, renderScale);
+}
+/**
+Upscales everything drawn since beginScaledRender() onto the window. Anything drawn afterwards is at native resolution.
+*/
+void endScaledRender()
+{
+    if(!scaledRenderActive)
+        return;
+    scaledRenderActive = false;
+    flushPrimitives();
+    SDL_SetRenderTarget(renderer, frameTarget);
+    SDL_Rect src{0, 0, (int)std::ceil(scaledTargetW * renderScale), (int)std::ceil(scaledTargetH * renderScale)};
+    SDL_RenderCopy(renderer, scaledTarget, &src, NULL);
+    drawCalls++;
+}
+/**
+Returns the resolution scale currently used by beginScaledRender() (1 = native)
+*/
+double getRenderScale()
+{
+    return renderScale;
+}
+/**
 Loads a Mix_Chunk* from a file and checks for errors
 */
 Mix_Chunk *loadMixChunk(const char *name)
 {
-    Mix_Chunk *t = Mix_LoadWAV(name);
+    initAudio();
+    SDL_RWops *rw = openEmbeddedRW(name);
+    Mix_Chunk *t = rw != NULL? Mix_LoadWAV_RW(rw, 1) : Mix_LoadWAV(name);
     if(t == nullptr)
     {
-        println("Error when loading audio file " + to_str(name));
-        println("Mix_GetError(): " + to_str(Mix_GetError()));
+        logError("Error when loading audio file %s", name);
+        logError("Mix_GetError(): %s", Mix_GetError());
     }
     return t;
 }
@@ -1305,11 +2471,13 @@ Loads a Mix_Music* from a file and checks for errors
 */
 Mix_Music *loadMixMusic(const char *name)
 {
-    Mix_Music *t = Mix_LoadMUS(name);
+    initAudio();
+    SDL_RWops *rw = openEmbeddedRW(name);
+    Mix_Music *t = rw != NULL? Mix_LoadMUS_RW(rw, 1) : Mix_LoadMUS(name);
     if(t == nullptr)
     {
-        println("Error when loading audio file " + to_str(name));
-        println("Mix_GetError(): " + to_str(Mix_GetError()));
+        logError("Error when loading audio file %s", name);
+        logError("Mix_GetError(): %s", Mix_GetError());
     }
     return t;
 }
@@ -1320,7 +2488,8 @@ void setMusicVolume(int v)
 {
     using namespace sdl_settings;
     musicVolume = std::min(MIX_MAX_VOLUME, std::max(0, v));
-    Mix_VolumeMusic(musicVolume);
+    if(audioReady) //otherwise it's applied when audio is opened
+        Mix_VolumeMusic(musicVolume);
 }
 /**
 Sets sfx (Mix_Chunk) volume
@@ -1329,5 +2498,6 @@ void setSfxVolume(int v)
 {
     using namespace sdl_settings;
     sfxVolume = std::min(MIX_MAX_VOLUME, std::max(0, v));
-    Mix_Volume(-1, sfxVolume);
+    if(audioReady)
+        Mix_Volume(-1, sfxVolume);
 }
@@ -2,7 +2,10 @@
 */
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
+#include <atomic>
+#include <memory>
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_mixer.h>
 #ifndef SDL_main
@@ -19,6 +22,12 @@ namespace sdl_settings
     extern bool showFPS, IS_FULLSCREEN; //overrides WINDOW_W and WINDOW_H
     extern int FPS_CAP; //FPS cap (300 is essentially uncapped)
     extern int TEXT_SDL_Texture_CACHE_TIME;
+    extern bool dynamicResolution; //scale the resolution of beginScaledRender()/endScaledRender() to stay within frameTimeBudget
+    extern double frameTimeBudget; //milliseconds
+    extern bool backgroundInit; //open fonts and image decoders on a background thread after initSDL instead of on first use
+    extern bool trace; //record spans and write them to trace.json at exit, see trace.h
+    extern int logLevel; //messages below this LogLevel are dropped, see logger.h
+    extern bool captureRaw; //startCapture writes raw RGBA frames, which is much faster than encoding PNGs
     /**
     Reads sdl_settings variables from a file
     */
@@ -29,11 +38,11 @@ namespace sdl_settings
     void load_config();
 }
 /**
-This prints a string to stdout
+This prints a string to stdout, through the logger at LOG_INFO
 */
 void print(std::string s);
 /**
-This prints a string and appends a newline to stdout
+This prints a string and appends a newline to stdout, through the logger at LOG_INFO
 */
 void println(std::string s);
 /**
@@ -76,6 +85,40 @@ struct generateRandZ
     }
 };
 /**
+Single producer, single consumer triple buffer. The writer fills getWriteBuffer() and calls publish(), the reader calls update() and then
+reads getReadBuffer(). Neither side ever blocks, and the reader always sees the most recently published value.
+*/
+template<class T> struct TripleBuffer
+{
+    static const int NEW_DATA = 4; //set in middle if the writer published since the reader last updated
+    T buf[3];
+    std::atomic<int> middle;
+    int front, back;
+    TripleBuffer(): middle(1), front(0), back(2){}
+    T &getWriteBuffer()
+    {
+        return buf[back];
+    }
+    void publish()
+    {
+        back = middle.exchange(back | NEW_DATA, std::memory_order_acq_rel) & 3;
+    }
+    /**
+    Swaps in the newest published value. Returns false if nothing was published since the last call.
+    */
+    bool update()
+    {
+        if(!(middle.load(std::memory_order_relaxed) & NEW_DATA))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    const T &getReadBuffer() const
+    {
+        return buf[front];
+    }
+};
+/**
 Generates a random integer from 0 to m-1
 */
 int randuzm(int m);
@@ -136,10 +179,15 @@ Calls SDL_Quit() and then restarts SDL
 */
 void reinitSDL();
 /**
-Equivalent to SDL_SetRenderDrawColor
+Sets the color used by renderClear and the primitive drawing functions
 */
 void setColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a=255);
 /**
+Draws all queued primitives. This happens automatically before anything else is drawn or the target changes, so it only has to be
+called before using the renderer directly.
+*/
+void flushPrimitives();
+/**
 Equivalent to SDL_RenderClear
 */
 void renderClear();
@@ -160,37 +208,74 @@ Equivalent to SDL_RenderCopy
 */
 void renderCopy(SDL_Texture *t, int x, int y, int w, int h);
 /**
+Draws src (or the whole texture if it's NULL) into the rectangle (x, y, w, h) of a view_w by view_h target, cropping it to the target
+in double precision first, so even hugely magnified textures are drawn exactly and only the visible texels are rasterized
+*/
+void renderCopyF(SDL_Texture *t, SDL_Rect *src, double x, double y, double w, double h, int view_w, int view_h);
+/**
 Equivalent to SDL_RenderCopyEx
 */
 void renderCopyEx(SDL_Texture *t, int x, int y, int w, int h, double rot, SDL_Point *center = NULL, SDL_RendererFlip f = SDL_FLIP_NONE);
 /**
+Equivalent to SDL_RenderGeometry
+*/
+void renderGeometry(SDL_Texture *t, const SDL_Vertex *vertices, int num_vertices, const int *indices, int num_indices);
+/**
 Converts a string into an SDL_Texture
 */
 SDL_Texture *createText(std::string txt, int s, uint8_t r, uint8_t g, uint8_t b, uint8_t a=255);
 /**
 Draws unwrapped text on the window. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME (1100ms by default).
 */
-void drawText(std::string text, int x, int y, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
+void drawText(std::string_view text, int x, int y, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
+/**
+Draws text one character at a time from a cached texture of every printable ASCII character, so text that changes every frame
+(like numbers) doesn't create a new texture every frame. The characters are queued like primitives and drawn together with one
+SDL_RenderGeometry call, even across calls with different colors. Characters outside printable ASCII are left out.
+*/
+void drawTextChars(std::string_view text, int x, int y, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
+/**
+Wrapped text broken into lines by layoutText, kept until the text, width or size changes
+*/
+struct TextLayout
+{
+    struct Line
+    {
+        size_t start, length; //part of text on this line
+    };
+    std::string text;
+    int w = -1, s = -1;
+    bool unbroken = false;
+    std::vector<Line> lines;
+};
+/**
+Lays out text wrapped to width w at size s, unless the layout already holds exactly that. If unbroken is set, breaks won't occur in the middle of words.
+*/
+void layoutText(TextLayout &layout, std::string_view text, int w, int s, bool unbroken = true);
+/**
+Draws text laid out by layoutText, returns the number of lines
+*/
+int drawTextLayout(const TextLayout &layout, int x, int y, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
 /**
 Draws wrapped text on the window, and breaks won't occur in the middle of words. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME.
 */
-int drawMultilineTextUnbroken(std::string text, int x, int y, int w, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
+int drawMultilineTextUnbroken(std::string_view text, int x, int y, int w, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
 /**
 Fills in xpos and ypos with the x and y position of the character AFTER the last character drawn from the drawMultilineTextUnbroken function.
 */
-void getMultilineTextUnbrokenInfo(std::string text, int w, int s, std::vector<std::string> &lines);
+void getMultilineTextUnbrokenInfo(std::string_view text, int w, int s, std::vector<std::string> &lines);
 /**
 Draws wrapped text on the window. The SDL_Texture is cached for TEXT_TEXTURE_CACHE_TIME.
 */
-int drawMultilineText(std::string text, int x, int y, int w, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
+int drawMultilineText(std::string_view text, int x, int y, int w, int s, uint8_t r=0, uint8_t g=0, uint8_t b=0, uint8_t a=255);
 /**
 Fills in xpos and ypos with the x and y position of the last character drawn from the drawMultilineText function.
 */
-void getMultilineTextPos(std::string text, int w, int s, int *xpos, int *ypos);
+void getMultilineTextPos(std::string_view text, int w, int s, int *xpos, int *ypos);
 /**
 Returns how many times a given text will be wrapped if it is drawn
 */
-int multilineTextLength(std::string text, int w, int s);
+int multilineTextLength(std::string_view text, int w, int s);
 /**
 Displays a loading screen
 */
@@ -236,14 +321,82 @@ Equivalent to SDL_SetTextureAlphaMod
 */
 void setTextureAlphaMod(SDL_Texture *t, uint8_t a);
 /**
+Gets an image file's size without decoding it, from the header of PNG and JPEG files. Other formats are decoded.
+Returns false on failure.
+*/
+bool getImageSize(const std::string &file_name, int &w, int &h);
+/**
 Loads a SDL_Texture from an image file and color keys it
 */
 SDL_Texture *loadTexture(const char *name, uint8_t r, uint8_t g, uint8_t b);
 /**
+Loads a SDL_Texture from an image file, color keys it, and fills in opaqueRect with getOpaqueRect() of the image
+*/
+SDL_Texture *loadTexture(const char *name, uint8_t r, uint8_t g, uint8_t b, SDL_Rect *opaqueRect);
+/**
 Loads a SDL_Texture from an image file
 */
 SDL_Texture *loadTexture(const char *name);
 /**
+Creates a SDL_Texture from a surface, color keys it, and fills in opaqueRect with getOpaqueRect() of the surface
+*/
+SDL_Texture *createTexture(SDL_Surface *s, uint8_t r, uint8_t g, uint8_t b, SDL_Rect *opaqueRect);
+/**
+Creates a SDL_Texture from a surface, keeping its color key if it has one
+*/
+SDL_Texture *createTexture(SDL_Surface *s);
+/**
+Returns the largest rectangle of a surface in which every pixel is fully opaque and not color keyed (w and h are 0 if there is none)
+*/
+SDL_Rect getOpaqueRect(SDL_Surface *s);
+/**
+Work for the background threads that decode images for loadSurfaceAsync, queued with runAsync. done is set once run() has returned.
+*/
+struct AsyncJob
+{
+    std::atomic<bool> done;
+    AsyncJob();
+    virtual ~AsyncJob();
+    virtual void run() = 0;
+};
+/**
+An image file being decoded on a background thread by loadSurfaceAsync
+*/
+struct AsyncSurface: AsyncJob
+{
+    std::string file_name;
+    SDL_Surface *surface; //NULL if loading failed. Freed along with the AsyncSurface unless set to NULL by whoever takes it.
+    bool keyed; //if set, the decoder also color keys surface with key and fills in opaque with its getOpaqueRect()
+    SDL_Color key;
+    SDL_Rect opaque;
+    AsyncSurface(const std::string &file_name);
+    ~AsyncSurface();
+    void run() override;
+};
+/**
+Queues a job to run on the background threads used by loadSurfaceAsync, in the same most recently queued first order. A job is
+skipped (but still marked done) if every other reference to it is dropped before it runs.
+*/
+void runAsync(const std::shared_ptr<AsyncJob> &job);
+/**
+Queues an image file to be decoded into an SDL_Surface on a background thread. The most recently queued files are decoded first,
+and a file is skipped if every other reference to its AsyncSurface is dropped before it's decoded.
+*/
+std::shared_ptr<AsyncSurface> loadSurfaceAsync(const std::string &file_name);
+/**
+Queues an image file to be decoded like loadSurfaceAsync(file_name), and also color keys it and finds its getOpaqueRect() on the
+background thread, so the thread that uploads it with createTexture(SDL_Surface*) doesn't have to scan it
+*/
+std::shared_ptr<AsyncSurface> loadSurfaceAsync(const std::string &file_name, uint8_t r, uint8_t g, uint8_t b);
+/**
+Blocks until an image file queued by loadSurfaceAsync has been decoded
+*/
+void waitForSurface(AsyncSurface &s);
+/**
+Returns the number of image files (and other runAsync jobs) queued or being worked on by the background threads
+*/
+int getPendingSurfaceLoads();
+/**
 Checks if two SDL_Rects intersect
 */
 bool rectsIntersect(SDL_Rect a, SDL_Rect b);
@@ -280,6 +433,15 @@ Draws an unfilled circle
 */
 void drawCircle(int x, int y, int rad, uint8_t r, uint8_t g, uint8_t b, uint8_t a=255);
 /**
+Draws an unfilled circle as one polyline, with segments short enough to stay within half a pixel of the circle. Only the arc that
+crosses the viewport is drawn, so circles far larger than the screen are as cheap as small ones.
+*/
+void drawRing(double x, double y, double rad);
+/**
+Draws an unfilled circle like drawRing(x, y, rad) in the given color
+*/
+void drawRing(double x, double y, double rad, uint8_t r, uint8_t g, uint8_t b, uint8_t a=255);
+/**
 Checks if the mouse is in a given SDL_Rect
 */
 bool mouseInRect(int x, int y, int w, int h);
@@ -316,6 +478,10 @@ Equivalent to SDL_SetWindowIcon
 */
 void setWindowIcon(SDL_Surface *icon);
 /**
+Shows or hides the window. Drawing still works while it's hidden, for example to feed startSharedMemoryOutput.
+*/
+void setWindowVisible(bool visible);
+/**
 Returns a pointer to TTF_Font of size 2^pos
 */
 TTF_Font *getFont(int pos);
@@ -332,6 +498,15 @@ Returns a pointer to the renderer
 */
 SDL_Renderer *getRenderer();
 /**
+Releases the renderer's OpenGL context (if it uses one) from the calling thread, so that another thread can draw after calling
+acquireRenderer(). Only one thread may draw at a time.
+*/
+void releaseRenderer();
+/**
+Makes the renderer's OpenGL context (if it uses one) current on the calling thread, after the last thread to draw called releaseRenderer()
+*/
+void acquireRenderer();
+/**
 Changes how long text textures are cached for
 */
 void setTextTextureCacheTime(int ms);
@@ -388,6 +563,38 @@ Returns the intermediate texture that effectively represents the display
 */
 SDL_Texture *getScreenTexture();
 /**
+Saves the next frame presented by updateScreen to a PNG file. Can be called from any thread.
+*/
+void takeScreenshot(const std::string &file_name);
+/**
+Saves every frame presented by updateScreen, numbered from 0, to prefix000000.png and so on, or as raw RGBA to
+prefix000000_WxH.rgba if CAPTURE_RAW is set. Can be called from any thread.
+*/
+void startCapture(const std::string &prefix);
+/**
+Stops saving frames started by startCapture
+*/
+void stopCapture();
+/**
+Returns true between startCapture and stopCapture, or while a screenshot hasn't been taken yet. Frames have to keep being
+presented until it returns false.
+*/
+bool isCapturing();
+/**
+Writes every frame presented by updateScreen into the POSIX shared memory object name, a ring of frames laid out as in
+shm_frames.h, for other processes on the same host to read. Returns false where that isn't supported (only Linux is). Can be
+called from any thread.
+*/
+bool startSharedMemoryOutput(const std::string &name);
+/**
+Stops the shared memory output started by startSharedMemoryOutput
+*/
+void stopSharedMemoryOutput();
+/**
+Waits until every captured frame has been written and closes the shared memory output. Call it once rendering has stopped.
+*/
+void finishCaptures();
+/**
 Returns the display width
 */
 int getDisplayW();
@@ -404,10 +611,47 @@ Changes the base text size returned by getFontSize
 */
 void setTextSizeMult(double m);
 /**
+Counters of the frames presented by updateScreen, for performance overlays
+*/
+struct RenderStats
+{
+    static const int HISTORY = 240;
+    float frame_ms[HISTORY] = {}; //time between presents, frame_ms[frames % HISTORY] is the oldest
+    int frames = 0; //frame times recorded so far
+    int draw_calls = 0; //in the last frame
+    long long text_hits = 0, text_misses = 0; //drawText cache lookups so far
+    int text_cache_size = 0;
+    long long text_cache_bytes = 0;
+    int allocs = 0; //heap allocations by the thread calling updateScreen during the last frame
+    long long alloc_bytes = 0;
+    long long alloc_frames = 0; //frames so far that allocated
+};
+/**
+Returns the counters of the last frame presented by updateScreen
+*/
+const RenderStats &getRenderStats();
+/**
+Returns how much memory a texture takes up, assuming 4 bytes per pixel
+*/
+long long getTextureBytes(SDL_Texture *t);
+/**
 Returns the current FPS
 */
 int getFPS();
 /**
+Redirects drawing into an offscreen target whose resolution is lowered when frames take longer than FRAME_TIME_BUDGET.
+Coordinates stay in window pixels. Does nothing unless DYNAMIC_RESOLUTION is set.
+*/
+void beginScaledRender();
+/**
+Upscales everything drawn since beginScaledRender() onto the window. Anything drawn afterwards is at native resolution.
+*/
+void endScaledRender();
+/**
+Returns the resolution scale currently used by beginScaledRender() (1 = native)
+*/
+double getRenderScale();
+/**
 Loads a Mix_Chunk* from a file and checks for errors
 */
 Mix_Chunk *loadMixChunk(const char *name);
@@ -0,0 +1,103 @@
+//Reference reader for the viewer's shared memory frame output (see shm_frames.h). Writes each new frame to a raw RGBA file.
+//Build with g++ -std=c++17 shm_consumer.cpp -o shm_consumer -pthread -lrt
+//Usage: shm_consumer <shared memory name> <output prefix> [number of frames]
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <thread>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shm_frames.h"
+using namespace std;
+//maps the whole shared memory object, returns NULL if the producer hasn't created it yet
+static ShmFramesHeader *openFrames(const char *name, size_t &size)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmFramesHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    size = st.st_size;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        return NULL;
+    ShmFramesHeader *h = (ShmFramesHeader*)p;
+    if(h->magic.load(memory_order_acquire) != SHM_FRAMES_MAGIC || shmFramesSize(*h) > size)
+    {
+        munmap(p, size);
+        return NULL;
+    }
+    return h;
+}
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        cout << "Usage: " << argv[0] << " <shared memory name> <output prefix> [number of frames]\n";
+        return 1;
+    }
+    long long max_frames = argc > 3? atoll(argv[3]) : -1;
+    long long written = 0, torn = 0;
+    uint64_t last = 0;
+    size_t size = 0;
+    ShmFramesHeader *h = NULL;
+    while(max_frames < 0 || written < max_frames)
+    {
+        if(h == NULL || h->closed)
+        {
+            if(h != NULL)
+                munmap(h, size);
+            h = openFrames(argv[1], size);
+            last = 0;
+            if(h == NULL)
+            {
+                this_thread::sleep_for(chrono::milliseconds(100));
+                continue;
+            }
+        }
+        timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec++;
+        if(sem_timedwait(&h->frame_ready, &t) != 0)
+            continue;
+        while(sem_trywait(&h->frame_ready) == 0); //frames that were missed are gone anyway, only the latest one is read
+        uint64_t seq = h->sequence;
+        if(seq == last)
+            continue;
+        int slot = seq % SHM_FRAME_SLOTS;
+        if(h->slot_sequence[slot] != seq)
+            continue;
+        char name[64];
+        snprintf(name, sizeof(name), "%06lld_%ux%u.rgba", written, h->width, h->height);
+        ofstream fout(argv[2] + string(name), ios::binary);
+        const char *pixels = (const char*)h + shmFrameOffset(*h, slot);
+        fout.write(pixels, (size_t)h->height * h->pitch); //straight from shared memory
+        fout.close();
+        if(h->slot_sequence[slot] != seq) //overwritten while it was being written out
+        {
+            torn++;
+            remove((argv[2] + string(name)).c_str());
+            continue;
+        }
+        if(seq > last + 1 && last != 0)
+            cout << "Skipped " << seq - last - 1 << " frames\n";
+        last = seq;
+        written++;
+    }
+    cout << written << " frames written, " << torn << " dropped because the producer overwrote them\n";
+    if(h != NULL)
+        munmap(h, size);
+    return 0;
+}
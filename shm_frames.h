@@ -0,0 +1,36 @@
+/*Layout of the shared memory frame ring written by startSharedMemoryOutput (Linux only), shared with programs that read it
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <semaphore.h>
+static const uint32_t SHM_FRAMES_MAGIC = 0x31465353;
+static const int SHM_FRAME_SLOTS = 3;
+/**
+Starts the shared memory object, and is followed by SHM_FRAME_SLOTS frames of height * pitch bytes at shmFrameOffset(slot).
+Frame n goes into slot n % SHM_FRAME_SLOTS: the producer sets its slot_sequence to 0, writes the pixels, then publishes the frame
+by setting slot_sequence and sequence to n and posting frame_ready. A consumer reads the latest slot in place and then checks that
+its slot_sequence hasn't changed, since the producer may have lapped it. When the producer stops or the frame size changes, closed
+is set and the object has to be opened again. The producer always creates a new object and stores magic last (with release
+ordering), so a consumer that loads magic with acquire ordering sees the rest of the header initialized.
+*/
+struct ShmFramesHeader
+{
+    std::atomic<uint32_t> magic;
+    uint32_t width, height, pitch; //pixels are RGBA, 4 bytes each, pitch is in bytes
+    std::atomic<uint32_t> closed;
+    std::atomic<uint64_t> sequence; //latest complete frame, numbered from 1, 0 if there is none yet
+    std::atomic<uint64_t> slot_sequence[SHM_FRAME_SLOTS]; //frame held by each slot, 0 while it's being written
+    sem_t frame_ready; //posted after each frame, shared between processes
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory atomics have to be lock free");
+inline size_t shmFrameOffset(const ShmFramesHeader &h, int slot)
+{
+    size_t header = (sizeof(ShmFramesHeader) + 63) / 64 * 64;
+    return header + (size_t)slot * h.height * h.pitch;
+}
+inline size_t shmFramesSize(const ShmFramesHeader &h)
+{
+    return shmFrameOffset(h, SHM_FRAME_SLOTS);
+}
@@ -0,0 +1,199 @@
+//Deep Zoom (.dzi) tile pyramids
+#include "tiled_image.h"
+#include "logger.h"
+#include "assets.h"
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+/**
+Returns the value of name="..." in a .dzi descriptor, or an empty string if it's missing
+*/
+static std::string dziAttribute(const std::string &xml, const std::string &name)
+{
+    size_t p = xml.find(name + "=\"");
+    if(p == std::string::npos)
+        return "";
+    p += name.size() + 2;
+    return xml.substr(p, xml.find('"', p) - p);
+}
+static uint64_t tileKey(int level, int c, int r)
+{
+    return ((uint64_t)level << 48) | ((uint64_t)c << 24) | (uint64_t)r;
+}
+TiledImage::TiledImage(): width(0), height(0), tile_size(0), overlap(0), max_level(0), base_level(0), base(NULL), uploads(0), loading(false){}
+TiledImage::~TiledImage()
+{
+    if(base != NULL)
+        SDL_DestroyTexture(base);
+    for(auto &i: tiles)
+        if(i.second.t != NULL)
+            SDL_DestroyTexture(i.second.t);
+}
+/**
+Reads a .dzi descriptor and queues the base level for decoding, so it can be called on any thread. Returns false on failure.
+*/
+bool TiledImage::load(const std::string &dzi_file)
+{
+    auto in = openAsset(dzi_file);
+    std::istream &fin = *in;
+    if(fin.fail())
+    {
+        logError("Failed to open Deep Zoom descriptor %s", dzi_file);
+        return false;
+    }
+    std::stringstream ss;
+    ss << fin.rdbuf();
+    std::string xml = ss.str();
+    format = dziAttribute(xml, "Format");
+    tile_size = atoi(dziAttribute(xml, "TileSize").c_str());
+    overlap = atoi(dziAttribute(xml, "Overlap").c_str());
+    width = atoi(dziAttribute(xml, "Width").c_str());
+    height = atoi(dziAttribute(xml, "Height").c_str());
+    if(tile_size<=0 || width<=0 || height<=0)
+    {
+        logError("Invalid Deep Zoom descriptor %s", dzi_file);
+        return false;
+    }
+    tile_dir = dzi_file.substr(0, dzi_file.rfind('.')) + "_files/";
+    max_level = std::ceil(std::log2(std::max(width, height)));
+    base_level = max_level;
+    while(base_level > 0 && (levelW(base_level) > tile_size || levelH(base_level) > tile_size))
+        base_level--;
+    base_pending = loadSurfaceAsync(tilePath(base_level, 0, 0));
+    return true;
+}
+/**
+Returns the width of a level in pixels
+*/
+int TiledImage::levelW(int level)
+{
+    int d = max_level - level;
+    return (width + (1LL << d) - 1) >> d;
+}
+/**
+Returns the height of a level in pixels
+*/
+int TiledImage::levelH(int level)
+{
+    int d = max_level - level;
+    return (height + (1LL << d) - 1) >> d;
+}
+/**
+Returns the memory used by the loaded tiles, including the base level
+*/
+long long TiledImage::textureBytes()
+{
+    long long bytes = getTextureBytes(base);
+    for(auto &i : tiles)
+        bytes += getTextureBytes(i.second.t);
+    return bytes;
+}
+std::string TiledImage::tilePath(int level, int c, int r)
+{
+    return tile_dir + to_str(level) + "/" + to_str(c) + "_" + to_str(r) + "." + format;
+}
+/**
+Returns a tile's texture if it's loaded, uploading it if it has just been decoded. If request is set, a missing tile starts loading.
+*/
+SDL_Texture *TiledImage::findTile(int level, int c, int r, bool request)
+{
+    if(level == base_level)
+        return base;
+    uint64_t key = tileKey(level, c, r);
+    auto it = tiles.find(key);
+    if(it == tiles.end())
+    {
+        if(!request)
+            return NULL;
+        it = tiles.emplace(key, Tile()).first;
+        lru.push_front(key);
+        it->second.lru = lru.begin();
+        it->second.pending = loadSurfaceAsync(tilePath(level, c, r));
+        loading = true;
+        return NULL;
+    }
+    Tile &tile = it->second;
+    lru.splice(lru.begin(), lru, tile.lru);
+    if(tile.pending && tile.pending->done && uploads < MAX_UPLOADS_PER_FRAME)
+    {
+        if(tile.pending->surface != NULL)
+        {
+            tile.t = SDL_CreateTextureFromSurface(getRenderer(), tile.pending->surface);
+            SDL_SetTextureBlendMode(tile.t, SDL_BLENDMODE_BLEND);
+            uploads++;
+        }
+        tile.pending.reset();
+    }
+    if(tile.pending)
+        loading = true;
+    return tile.t;
+}
+/**
+Draws one tile of a level, or the matching part of its sharpest loaded ancestor. (x, y) is the image's position and sx, sy are screen
+pixels per level pixel.
+*/
+void TiledImage::drawTile(int level, int c, int r, double x, double y, double sx, double sy, uint8_t alpha, int view_w, int view_h)
+{
+    //the tile's area in level pixels, snapped to whole screen pixels so neighboring tiles meet exactly; kept in double precision,
+    //since tiles of the sharpest level can be far bigger than the screen
+    int px = c * tile_size, py = r * tile_size;
+    int pw = std::min(tile_size, levelW(level) - px), ph = std::min(tile_size, levelH(level) - py);
+    double x1 = std::floor(x + px*sx), y1 = std::floor(y + py*sy);
+    double x2 = std::floor(x + (px+pw)*sx), y2 = std::floor(y + (py+ph)*sy);
+    for(int k=level; k>=base_level; k--)
+    {
+        int d = level - k, ac = c >> d, ar = r >> d;
+        SDL_Texture *t = findTile(k, ac, ar, k == level);
+        if(t == NULL)
+            continue;
+        //tiles other than the first in a row or column start with overlap pixels shared with their neighbor
+        double f = 1.0 / (1 << d);
+        SDL_Rect src{(int)std::floor(px*f) - ac*tile_size + (ac>0? overlap : 0), (int)std::floor(py*f) - ar*tile_size + (ar>0? overlap : 0),
+                     std::max(1, (int)std::round(pw*f)), std::max(1, (int)std::round(ph*f))};
+        SDL_SetTextureAlphaMod(t, alpha);
+        renderCopyF(t, &src, x1, y1, x2 - x1, y2 - y1, view_w, view_h);
+        return;
+    }
+}
+/**
+Draws the image at (x, y) with size w by h, clipped to a view_w by view_h target, and requests any missing tiles. Returns true if
+any of the tiles it needs are still being decoded or waiting to be uploaded, so another frame should be drawn to show them.
+*/
+bool TiledImage::render(double x, double y, double w, double h, uint8_t alpha, int view_w, int view_h)
+{
+    if(base_pending && base_pending->done)
+    {
+        if(base_pending->surface != NULL)
+            base = createTexture(base_pending->surface);
+        base_pending.reset();
+    }
+    if(base == NULL)
+        return base_pending != NULL;
+    //the coarsest level with at least one texel per screen pixel
+    int level = max_level - (int)std::floor(std::log2(width / w));
+    level = std::max(base_level, std::min(max_level, level));
+    int lw = levelW(level), lh = levelH(level);
+    double sx = w / lw, sy = h / lh;
+    //the part of the level that's in view, in level pixels
+    double u1 = std::max(0.0, -x / sx), v1 = std::max(0.0, -y / sy);
+    double u2 = std::min((double)lw, (view_w - x) / sx), v2 = std::min((double)lh, (view_h - y) / sy);
+    if(u1>=u2 || v1>=v2)
+        return false;
+    int c1 = u1 / tile_size, r1 = v1 / tile_size;
+    int c2 = std::min((lw - 1) / tile_size, (int)(u2 / tile_size)), r2 = std::min((lh - 1) / tile_size, (int)(v2 / tile_size));
+    uploads = 0;
+    loading = false;
+    for(int r=r1; r<=r2; r++)
+        for(int c=c1; c<=c2; c++)
+            drawTile(level, c, r, x, y, sx, sy, alpha, view_w, view_h);
+    while((int)tiles.size() > TILE_CACHE_SIZE)
+    {
+        auto it = tiles.find(lru.back());
+        if(it->second.t != NULL)
+            SDL_DestroyTexture(it->second.t);
+        tiles.erase(it);
+        lru.pop_back();
+    }
+    return loading;
+}
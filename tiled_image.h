@@ -0,0 +1,62 @@
+/*Deep Zoom (.dzi) tile pyramids
+*/
+#pragma once
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include "sdl_base.h"
+/**
+An image stored as a Deep Zoom tile pyramid (name.dzi next to a name_files/ directory). Only the tiles that are on screen at the
+level that's needed are decoded (on a background thread) and uploaded, and the least recently used ones are dropped once more than
+TILE_CACHE_SIZE are loaded. Until a tile is loaded, the sharpest loaded tile above it in the pyramid is drawn instead.
+*/
+struct TiledImage
+{
+    static const int TILE_CACHE_SIZE = 512;
+    static const int MAX_UPLOADS_PER_FRAME = 4; //uploads happen on the render thread, so they're spread over several frames
+    struct Tile
+    {
+        SDL_Texture *t = NULL;
+        std::shared_ptr<AsyncSurface> pending;
+        std::list<uint64_t>::iterator lru;
+    };
+    std::string tile_dir, format;
+    int width, height, tile_size, overlap;
+    int max_level, base_level; //base_level is the sharpest level that fits in a single tile, and it stays loaded
+    SDL_Texture *base;
+    std::shared_ptr<AsyncSurface> base_pending; //the base level is decoded in the background too, and nothing is drawn until it's uploaded
+    std::unordered_map<uint64_t, Tile> tiles;
+    std::list<uint64_t> lru; //most recently used first
+    TiledImage();
+    TiledImage(const TiledImage&) = delete;
+    TiledImage &operator=(const TiledImage&) = delete;
+    ~TiledImage();
+    /**
+    Reads a .dzi descriptor and queues the base level for decoding, so it can be called on any thread. Returns false on failure.
+    */
+    bool load(const std::string &dzi_file);
+    /**
+    Draws the image at (x, y) with size w by h, clipped to a view_w by view_h target, and requests any missing tiles. Returns true if
+    any of the tiles it needs are still being decoded or waiting to be uploaded, so another frame should be drawn to show them.
+    */
+    bool render(double x, double y, double w, double h, uint8_t alpha, int view_w, int view_h);
+    /**
+    Returns the width of a level in pixels
+    */
+    int levelW(int level);
+    /**
+    Returns the height of a level in pixels
+    */
+    int levelH(int level);
+    /**
+    Returns the memory used by the loaded tiles, including the base level
+    */
+    long long textureBytes();
+private:
+    int uploads;
+    bool loading; //set by findTile during render()
+    std::string tilePath(int level, int c, int r);
+    SDL_Texture *findTile(int level, int c, int r, bool request);
+    void drawTile(int level, int c, int r, double x, double y, double sx, double sy, uint8_t alpha, int view_w, int view_h);
+};
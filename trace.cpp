@@ -0,0 +1,88 @@
+//Timeline tracing, written as a Chrome trace (JSON)
+#include "trace.h"
+#include "logger.h"
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <string>
+#include <iomanip>
+struct TraceEvent
+{
+    const char *name;
+    long long start, end;
+};
+//each thread records into its own buffer. The lock is only ever contended while the trace is being written.
+struct ThreadTrace
+{
+    std::mutex m;
+    int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+static std::mutex threadsMutex;
+static std::vector<ThreadTrace*> threads; //never freed, since detached threads may still be recording at exit
+static ThreadTrace *getThreadTrace()
+{
+    thread_local ThreadTrace *t = NULL;
+    if(t == NULL)
+    {
+        t = new ThreadTrace;
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        t->tid = threads.size() + 1;
+        threads.push_back(t);
+    }
+    return t;
+}
+/**
+Records an event named name (a string literal, since only the pointer is kept) from start to end, in ns from getTicksNs()
+*/
+void traceEvent(const char *name, long long start, long long end)
+{
+    ThreadTrace *t = getThreadTrace();
+    std::lock_guard<std::mutex> lock(t->m);
+    t->events.push_back(TraceEvent{name, start, end});
+}
+/**
+Names the calling thread in the trace
+*/
+void traceThreadName(const char *name)
+{
+    if(!sdl_settings::trace)
+        return;
+    ThreadTrace *t = getThreadTrace();
+    std::lock_guard<std::mutex> lock(t->m);
+    t->name = name;
+}
+/**
+Writes every recorded event to a Chrome trace file
+*/
+void writeTrace(const char *file_name)
+{
+    std::ofstream fout(file_name);
+    if(fout.fail())
+    {
+        logError("Failed to write trace %s", file_name);
+        return;
+    }
+    fout << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for(auto t: threads)
+    {
+        std::lock_guard<std::mutex> thread_lock(t->m);
+        if(!t->name.empty())
+        {
+            fout << (first? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t->tid
+                 << ",\"args\":{\"name\":\"" << t->name << "\"}}";
+            first = false;
+        }
+        for(auto &e: t->events)
+        {
+            //timestamps are in microseconds
+            fout << (first? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t->tid
+                 << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+            first = false;
+        }
+    }
+    fout << "\n]}\n";
+}
@@ -0,0 +1,41 @@
+/*Timeline tracing, written as a Chrome trace (JSON) that chrome://tracing and Perfetto can open. Spans are only recorded when TRACE
+is set in sdl_base_config.txt, and compiled out entirely if SDL_BASE_NO_TRACE is defined.
+*/
+#pragma once
+#include "sdl_base.h"
+/**
+Records an event named name (a string literal, since only the pointer is kept) from start to end, in ns from getTicksNs()
+*/
+void traceEvent(const char *name, long long start, long long end);
+/**
+Names the calling thread in the trace
+*/
+void traceThreadName(const char *name);
+/**
+Writes every recorded event to a Chrome trace file
+*/
+void writeTrace(const char *file_name);
+/**
+Records the time from its construction to its destruction
+*/
+struct TraceSpan
+{
+    const char *name;
+    long long start; //-1 if tracing is off
+    explicit TraceSpan(const char *name): name(name), start(sdl_settings::trace? getTicksNs() : -1){}
+    ~TraceSpan()
+    {
+        if(start >= 0)
+            traceEvent(name, start, getTicksNs());
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan &operator=(const TraceSpan&) = delete;
+};
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#ifdef SDL_BASE_NO_TRACE
+#define TRACE_SCOPE(name)
+#else
+//traces the rest of the enclosing scope
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#endif